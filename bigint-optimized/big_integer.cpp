@@ -1,170 +1,140 @@
+#include <algorithm>
 #include <cassert>
+#include <stdexcept>
 #include "big_integer.h"
-
-typedef unsigned __int128 uint128_t;
-
-big_integer big_integer::abs() const {
-    return sign ? -(*this) : *this;
-}
+#include "limbs.h"
 
 namespace {
-    // Get digit of bigint after negating (if is_negated) without creating new bigint
-    // (You need to go from digit 0 to digit.size() - 1 sequentially, c is a carry flag,
-    // when it's first digit c should be equal to is_negated)
-    uint32_t negate_digit(bool is_negated, uint32_t x, bool &c) {
-        if (is_negated) {
-            x ^= UINT32_MAX;
-            x += c;
-            if (x != 0) {
-                c = false;
-            }
-        }
-        return x;
-    }
-
-    // Returns useless digit for a given sign
-    uint32_t udg(bool sign) {
-        return sign ? UINT32_MAX : 0;
-    }
-
-    // Adds uint32 with carry flag
-    void addc(uint32_t& a, uint32_t b, bool & c) {
-        a += b + c;
-        c = a < b + c || (b == UINT32_MAX && c);
-    }
-}
-
-// Returns a digit if i is in range, or a useless digit if it's not.
-uint32_t big_integer::get(size_t i) const {
-    if (i < digits.size()) {
-        return digits[i];
-    } else {
-        return udg(sign);
+    // Sign extension limb of the two's complement form
+    uint64_t udg(bool sign) {
+        return sign ? UINT64_MAX : 0;
     }
 }
 
+// Adds b (or -b if is_negated) to the magnitude with the matching sign rule,
+// the larger magnitude keeps its sign when the signs differ
 void big_integer::add(big_integer const& b, bool is_negated) {
-    if (!b.sign && b.digits.empty()) {
+    size_t n = digits.size();
+    size_t m = b.digits.size();
+    if (m == 0) {
         return;
     }
-    if (b.sign && b.digits.empty() && is_negated) {
-        add(1, false);
-        return;
-    }
-    convert(std::max(digits.size(), b.digits.size()));
-    bool c = false;
-    bool negate_c = is_negated;
     bool b_sign = b.sign ^ is_negated;
-    for (size_t i = 0; i < digits.size(); i++) {
-        uint32_t x = negate_digit(is_negated, b.get(i), negate_c);
-        addc(digits[i], x, c);
-    }
-    if (negate_c) {
-        digits.push_back(udg(sign));
-        addc(digits.back(), negate_digit(is_negated, udg(b.sign), negate_c), c);
-    }
-
-    if (sign && b_sign) {
-        if (!c) {
-            digits.push_back(UINT32_MAX - 1);
-        }
-    } else if (c) {
-        if (sign || b_sign) {
-            sign = false;
+    if (n <= 1 && m == 1) {
+        uint64_t x = small_value();
+        uint64_t y = b.small_value();
+        if (sign == b_sign) {
+            uint64_t s;
+            bool carry = __builtin_add_overflow(x, y, &s);
+            assign_small(s, carry, sign);
+        } else if (x >= y) {
+            assign_small(x - y, 0, sign);
         } else {
-            digits.push_back(1);
+            assign_small(y - x, 0, b_sign);
         }
+        return;
+    }
+    if (sign == b_sign) {
+        size_t len = std::max(n, m);
+        digits.resize(len + 1);
+        uint64_t* d = digits.begin();
+        uint64_t const* bd = b.digits.begin();
+        d[len] = (n >= m ? limbs::add(d, d, n, bd, m) : limbs::add(d, bd, m, d, n));
     } else {
-        sign |= b_sign;
+        uint64_t const* bd = b.digits.begin();
+        int c = limbs::cmp(digits.begin(), n, bd, m);
+        if (c >= 0) {
+            uint64_t* d = digits.begin();
+            limbs::sub(d, d, n, b.digits.begin(), m);
+        } else {
+            digits.resize(m);
+            uint64_t* d = digits.begin();
+            limbs::sub(d, b.digits.begin(), m, d, n);
+            sign = b_sign;
+        }
     }
     format();
 }
 
-// Converting digits up to size sz by adding useless digits
-void big_integer::convert(size_t sz) {
-    while (digits.size() < sz) {
-        digits.push_back(sign ? UINT32_MAX : 0);
+// The value becomes high * B + low with the given sign, the heap is only touched when high != 0
+void big_integer::assign_small(uint64_t low, uint64_t high, bool negative) {
+    size_t n = (high != 0 ? 2 : low != 0 ? 1 : 0);
+    digits.resize(n);
+    if (n != 0) {
+        uint64_t* d = digits.begin();
+        d[0] = low;
+        if (n == 2) {
+            d[1] = high;
+        }
     }
+    sign = negative && n != 0;
 }
 
-// Delete useless digits
+// Delete leading zero limbs, zero is never negative
 void big_integer::format() {
-    while (!digits.empty() && digits.back() == (sign ? UINT32_MAX : 0)) {
-        digits.pop_back();
+    limb_vector const& d = digits;
+    size_t n = limbs::normalized(d.begin(), d.size());
+    if (n != d.size()) {
+        digits.resize(n);
     }
-}
-
-// Compare bigint with shifted prefix of other bigint (bigints are not negative)
-bool big_integer::less(big_integer const &b, size_t ind) const {
-    assert(!sign && !b.sign);
-    for (size_t i = 1; i <= digits.size(); i++) {
-        if (digits[digits.size() - i] != (ind - i < b.digits.size() ? b.digits[ind - i] : 0)) {
-            return digits[digits.size() - i] > (ind - i < b.digits.size() ? b.digits[ind - i] : 0);
-        }
+    if (n == 0) {
+        sign = false;
     }
-    return true;
 }
 
-namespace {
-    uint32_t cast_64_down_to_32(uint64_t x) {
-        return static_cast<uint32_t>(x & UINT32_MAX);
+// Both operands go to two's complement with one extra limb, so that the result fits.
+// op on the common limbs goes to kernel, the rest of the longer operand meets
+// the sign extension of the shorter one without materializing it.
+template<typename Op>
+void big_integer::bit_op(big_integer const& b, Op op, bit_kernel kernel) {
+    size_t n = digits.size();
+    size_t m = b.digits.size();
+    size_t len = std::max(n, m) + 1;
+    uint64_t fill = udg(sign);
+    uint64_t b_fill = udg(b.sign);
+    limbs::arena_frame frame;
+    uint64_t* b_twos = nullptr;
+    if (b.sign) {
+        b_twos = frame.alloc(m);
+        limbs::neg(b_twos, b.digits.begin(), m);
     }
-}
-
-// Subtracts a shifted prefix of other bigint from bigint (bigints are not negative)
-void big_integer::diff(big_integer const & b, size_t ind) {
-    assert(!sign && !b.sign);
-    size_t start = digits.size() - ind;
-    bool c = false;
-    for (size_t i = 0; i < ind; ++i) {
-        uint32_t x = digits[start + i];
-        uint32_t y = (i < b.digits.size() ? b.digits[i] : 0);
-        uint64_t res = (static_cast<uint64_t>(x) - y) - c;
-        c = (static_cast<uint64_t>(y) + c > x);
-        digits[start + i] = cast_64_down_to_32(res);
+    digits.resize(len);
+    uint64_t* d = digits.begin();
+    uint64_t const* bd = (b.sign ? b_twos : b.digits.begin());
+    if (sign) {
+        limbs::neg(d, d, n);
     }
-}
-
-// Result of dividing a bigint by uint32
-big_integer big_integer::div_short(uint32_t b) const {
-    big_integer res;
-    uint64_t c = 0;
-    uint64_t x = 0;
-    for (size_t i = 0; i < digits.size(); i++) {
-        x = (c << 32) | digits[digits.size() - 1 - i];
-        res.digits.push_back(cast_64_down_to_32(x / b));
-        c = x % b;
-    }
-    std::reverse(res.digits.begin(), res.digits.end());
-    res.format();
-    return res;
-}
-
-void big_integer::bit_op(big_integer const& b, const std::function<uint32_t(uint32_t, uint32_t)>& op) {
-    convert(std::max(digits.size(), b.digits.size()));
-    for (size_t i = 0; i < digits.size(); i++) {
-        digits[i] = op(digits[i], b.get(i));
+    kernel(d, d, bd, std::min(n, m));
+    for (size_t i = m; i < n; i++) {
+        d[i] = op(d[i], b_fill);
+    }
+    for (size_t i = n; i < m; i++) {
+        d[i] = op(fill, bd[i]);
+    }
+    d[len - 1] = op(fill, b_fill);
+    sign = (d[len - 1] != 0);
+    if (sign) {
+        limbs::neg(d, d, len);
     }
-    sign = op(sign, b.sign);
     format();
 }
 
-namespace {
-    uint32_t _or(uint32_t a, uint32_t b) {
-        return a | b;
-    }
+big_integer::big_integer(): sign(false) {}
 
-    uint32_t _and(uint32_t a, uint32_t b) {
-        return a & b;
-    }
+// The moved-from number is left as zero
+big_integer::big_integer(big_integer&& other) noexcept: digits(std::move(other.digits)), sign(other.sign) {
+    other.sign = false;
+}
 
-    uint32_t _xor(uint32_t a, uint32_t b) {
-        return a ^ b;
+big_integer& big_integer::operator=(big_integer&& other) noexcept {
+    if (&other != this) {
+        digits = std::move(other.digits);
+        sign = other.sign;
+        other.sign = false;
     }
+    return *this;
 }
 
-big_integer::big_integer(): sign(false) {}
-
 big_integer::big_integer(uint32_t x) : sign(false) {
     if (x != 0) {
         digits.push_back(x);
@@ -172,65 +142,38 @@ big_integer::big_integer(uint32_t x) : sign(false) {
 }
 
 big_integer::big_integer(int x): big_integer(static_cast<uint32_t>(std::abs(static_cast<long long>(x)))) {
-    if (x < 0) {
-        negate();
-    }
-}
-
-// Building bigint by adding substrings (len <= 8)
-void big_integer::append_substr(std::string const& s) {
-    assert(s.length() <= 8);
-    uint32_t k = 1;
-    for (size_t i = 0; i < s.size(); i++) {
-        k *= 10;
-    }
-    *this *= k;
-    *this += std::stoi(s);
+    sign = (x < 0);
 }
 
+// An optional sign and at least one digit, checked once before the digits are split up
 big_integer::big_integer(std::string const& s) : big_integer() {
-    for (size_t i = s[0] == '-'; i < s.size(); i += 8) {
-        append_substr(s.substr(i, 8));
-    }
-    if (s[0] == '-') {
-        negate();
+    bool negative = (!s.empty() && s[0] == '-');
+    size_t start = (!s.empty() && (s[0] == '-' || s[0] == '+'));
+    if (start == s.size() || !std::all_of(s.begin() + start, s.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        throw std::invalid_argument("big_integer: not a decimal number: \"" + s + "\"");
     }
+    std::vector<uint64_t> magnitude = limbs::from_decimal(s.data() + start, s.size() - start);
+    digits.resize(magnitude.size());
+    std::copy(magnitude.begin(), magnitude.end(), digits.begin());
+    sign = negative && !digits.empty();
 }
 
 std::string to_string(big_integer const& x) {
-    big_integer x_abs = x.abs();
-    std::string res;
-    while (x_abs > 0) {
-        big_integer r = x_abs % 10;
-        uint32_t c = (r == 0 ? 0 : r.digits[0]);
-        res.push_back('0' + c);
-        x_abs /= 10;
-    }
-    if (x.sign) {
-        res.push_back('-');
+    std::string res = limbs::to_decimal(x.digits.begin(), x.digits.size());
+    if (res.empty()) {
+        return "0";
     }
-    std::reverse(res.begin(), res.end());
-    return res.empty() ? "0" : res;
+    return x.sign ? '-' + res : res;
 }
 
+// ~x = -x - 1
 void big_integer::tilde() {
-    for (size_t i = 0; i < digits.size(); i++) {
-        digits[i] ^= UINT32_MAX;
-    }
-    sign ^= true;
+    negate();
+    add(1, true);
 }
 
 void big_integer::negate() {
-    if (digits.empty()) {
-        if (sign) {
-            sign = false;
-            digits.push_back(1);
-        }
-    } else {
-        tilde();
-        *this += 1;
-        format();
-    }
+    sign = !sign && !digits.empty();
 }
 
 big_integer big_integer::operator~() const{
@@ -271,127 +214,643 @@ big_integer big_integer::operator--(int) {
 
 
 big_integer operator+(big_integer a, big_integer const& b) {
-    return a += b;
+    a += b;
+    return a;
+}
+
+big_integer operator+(big_integer const& a, big_integer&& b) {
+    b += a;
+    return std::move(b);
 }
 
 big_integer operator-(big_integer a, big_integer const& b) {
-    return a -= b;
+    a -= b;
+    return a;
 }
 
-big_integer operator*(big_integer const& a, big_integer const& b) {
+// a - b = -(b - a)
+big_integer operator-(big_integer const& a, big_integer&& b) {
+    b -= a;
+    b.negate();
+    return std::move(b);
+}
+
+big_integer big_integer::multiply(big_integer const& a, big_integer const& b) {
+    // x * x, or two copies sharing one COW buffer
+    bool square = a.digits.size() == b.digits.size() && a.digits.begin() == b.digits.begin();
+    size_t n = a.digits.size();
+    size_t m = b.digits.size();
     big_integer res;
-    res.convert(a.digits.size() + b.digits.size());
-    bool ca = a.sign;
-    for (size_t i = 0; i < a.digits.size() + ca; i++) {
-        uint32_t xa = (i < a.digits.size() ? negate_digit(a.sign, a.digits[i], ca) : ca);
-        uint32_t c = 0;
-        bool cb = b.sign;
-        for (size_t j = 0; j < b.digits.size() + cb; j++) {
-            uint64_t mul = static_cast<uint64_t>(xa) * (j < b.digits.size() ? negate_digit(b.sign, b.digits[j], cb) : cb) +
-                           static_cast<uint64_t>(res.digits[i + j]) + c;
-            res.digits[i + j] = cast_64_down_to_32(mul);
-            c = mul >> 32;
-        }
-        res.digits[i + b.digits.size()] = c;
+    if (n == 0 || m == 0) {
+        return res;
     }
-    res.format();
-    if (a.sign ^ b.sign) {
-        res.negate();
+    if (n == 1 && m == 1) {
+        limbs::uint128_t p = static_cast<limbs::uint128_t>(a.digits[0]) * b.digits[0];
+        res.assign_small(static_cast<uint64_t>(p), static_cast<uint64_t>(p >> 64), a.sign ^ b.sign);
+        return res;
+    }
+    // one spare limb, so that adding to the product stays in its buffer
+    res.digits.resize(n + m + 1);
+    if (square) {
+        limbs::sqr(res.digits.begin(), a.digits.begin(), n);
+    } else {
+        limbs::mul(res.digits.begin(), a.digits.begin(), n, b.digits.begin(), m);
     }
+    res.sign = a.sign ^ b.sign;
+    res.format();
     return res;
 }
 
-namespace {
-    uint128_t shiftr128(uint32_t x, int shift) {
-        return static_cast<uint128_t>(x) << shift;
+#ifndef BIG_INTEGER_EXPRESSION_TEMPLATES
+big_integer operator*(big_integer const& a, big_integer const& b) {
+    return big_integer::multiply(a, b);
+}
+#endif
+
+// acc += a * b, or acc -= a * b if negate. When the product only grows |acc| and the operands
+// are short it is accumulated row by row in the buffer of acc, otherwise it goes through multiply.
+void big_integer::add_product(big_integer& acc, big_integer const& a, big_integer const& b, bool negate) {
+    size_t n = a.digits.size();
+    size_t m = b.digits.size();
+    if (n == 0 || m == 0) {
+        return;
     }
+    bool p_sign = a.sign ^ b.sign ^ negate;
+    bool in_place = (acc.digits.empty() || acc.sign == p_sign) && &acc != &a && &acc != &b
+                    && std::min(n, m) < limbs::KARATSUBA_THRESHOLD;
+    if (!in_place) {
+        acc.add(multiply(a, b), negate);
+        return;
+    }
+    uint64_t const* ad = a.digits.begin();
+    uint64_t const* bd = b.digits.begin();
+    if (n < m) {
+        std::swap(ad, bd);
+        std::swap(n, m);
+    }
+    size_t len = std::max(acc.digits.size(), n + m) + 1;
+    acc.digits.resize(len);
+    acc.sign = p_sign;
+    uint64_t* d = acc.digits.begin();
+    for (size_t i = 0; i < m; i++) {
+        uint64_t c = limbs::addmul_1(d + i, ad, n, bd[i]);
+        for (size_t j = i + n; c != 0; j++) {
+            d[j] += c;
+            c = (d[j] < c);
+        }
+    }
+    acc.format();
+}
+
+void addmul(big_integer& acc, big_integer const& a, big_integer const& b) {
+    big_integer::add_product(acc, a, b, false);
+}
 
-    uint128_t shift_or_128(opt_vector const& digits, size_t k) {
-        uint128_t res = 0;
-        for (size_t i = 1; i <= k; i++) {
-            res |= shiftr128(digits[digits.size() - i], 32 * (k - i));
+void submul(big_integer& acc, big_integer const& a, big_integer const& b) {
+    big_integer::add_product(acc, a, b, true);
+}
+
+// The product limbs are divided where they are: the spare top limb of p takes the bits shifted
+// out by the normalization, and only the remainder becomes a big_integer
+big_integer mulmod(big_integer const& a, big_integer const& b, big_integer const& m) {
+    size_t n = a.digits.size();
+    size_t k = b.digits.size();
+    size_t l = m.digits.size();
+    if (n == 0 || k == 0) {
+        return 0;
+    }
+    limbs::arena_frame frame;
+    uint64_t* p = frame.alloc(n + k + 1);
+    if (a.digits.begin() == b.digits.begin() && n == k) {
+        limbs::sqr(p, a.digits.begin(), n);
+    } else {
+        limbs::mul(p, a.digits.begin(), n, b.digits.begin(), k);
+    }
+    size_t len = limbs::normalized(p, n + k);
+    big_integer r;
+    if (limbs::cmp(p, len, m.digits.begin(), l) < 0) {
+        r.digits.resize(len);
+        std::copy_n(p, len, r.digits.begin());
+    } else if (l == 1) {
+        r.assign_small(limbs::div_1(p, p, len, m.digits[0]), 0, false);
+    } else {
+        unsigned s = __builtin_clzll(m.digits[l - 1]);
+        uint64_t* mn = frame.alloc(l);
+        limbs::lshift(mn, m.digits.begin(), l, s);
+        p[len] = limbs::lshift(p, p, len, s);
+        limbs::divrem_normalized(frame.alloc(len + 1 - l), p, len + 1, mn, l);
+        r.digits.resize(l);
+        limbs::rshift(r.digits.begin(), p, l, s);
+    }
+    r.sign = a.sign ^ b.sign;
+    r.format();
+    return r;
+}
+
+// The base is reduced once, the powering itself runs on limbs in the arena
+big_integer powmod(big_integer const& base, big_integer const& exp, big_integer const& mod) {
+    if (exp.sign) {
+        throw std::domain_error("powmod: negative exponent");
+    }
+    if (mod.digits.empty()) {
+        throw std::domain_error("powmod: zero modulus");
+    }
+    size_t n = base.digits.size();
+    size_t k = exp.digits.size();
+    size_t l = mod.digits.size();
+    uint64_t const* m = mod.digits.begin();
+    big_integer r;
+    if (l == 1 && m[0] == 1) {
+        return r;
+    }
+    if (k == 0) {
+        r.assign_small(1, 0, false);
+        return r;
+    }
+    limbs::arena_frame frame;
+    uint64_t* a = frame.alloc(l);
+    if (limbs::cmp(base.digits.begin(), n, m, l) < 0) {
+        std::fill_n(std::copy_n(base.digits.begin(), n, a), l - n, 0);
+    } else {
+        limbs::divrem(frame.alloc(n - l + 1), a, base.digits.begin(), n, m, l);
+    }
+    r.digits.resize(l);
+    limbs::powmod(r.digits.begin(), a, exp.digits.begin(), k, m, l);
+    r.sign = base.sign && (exp.digits[0] & 1) != 0;
+    r.format();
+    return r;
+}
+
+barrett_context::barrett_context(big_integer const& m): m(m), norm(m.digits.size()) {
+    size_t n = norm.size();
+    if (n == 0) {
+        throw std::domain_error("barrett_context: zero modulus");
+    }
+    shift = __builtin_clzll(m.digits[n - 1]);
+    limbs::lshift(norm.data(), m.digits.begin(), n, shift);
+    if (n >= limbs::BARRETT_THRESHOLD) {
+        inv.resize(n + 1);
+        limbs::reciprocal(inv.data(), norm.data(), n);
+    }
+}
+
+// res = x[0..nx) % m with the given sign. x may be the buffer of res, it is read before res
+// is written. A value below 2m costs one subtraction, anything longer is shifted like the
+// dividend of divrem and divided by the normalized modulus. The shift goes to w[0..nx + 1),
+// which may be x itself, or to the arena when w is null.
+void barrett_context::reduce_limbs(big_integer& res, uint64_t const* x, size_t nx, bool negative,
+                                   uint64_t* w) const {
+    size_t n = norm.size();
+    uint64_t const* md = m.digits.begin();
+    nx = limbs::normalized(x, nx);
+    limbs::arena_frame frame;
+    uint64_t const* r = x;
+    size_t len = nx;
+    if (limbs::cmp(x, nx, md, n) >= 0) {
+        uint64_t* d = nullptr;
+        if (nx <= n + 1) {
+            d = frame.alloc(nx);
+            limbs::sub(d, x, nx, md, n);
+            len = limbs::normalized(d, nx);
         }
-        return res;
+        if (d == nullptr || limbs::cmp(d, len, md, n) >= 0) {
+            // the extra top limb keeps the top n limbs below the modulus, it is not needed
+            // when they are below it anyway, as for a product of two reduced values
+            size_t wn = nx + 1;
+            if (w == nullptr) {
+                w = frame.alloc(wn);
+            }
+            w[nx] = limbs::lshift(w, x, nx, shift);
+            if (w[nx] == 0 && limbs::cmp(w + nx - n, n, norm.data(), n) < 0) {
+                wn--;
+            }
+            if (n >= limbs::BARRETT_THRESHOLD) {
+                limbs::mod_barrett(w, wn, norm.data(), n, inv.data());
+            } else if (n >= limbs::BZ_THRESHOLD) {
+                limbs::divrem_bz(frame.alloc(wn - n), w, wn, norm.data(), n);
+            } else {
+                limbs::divrem_basecase(frame.alloc(wn - n), w, wn, norm.data(), n);
+            }
+            d = frame.alloc(n);
+            limbs::rshift(d, w, n, shift);
+            len = limbs::normalized(d, n);
+        }
+        r = d;
     }
+    res.digits.resize(len);
+    // x already below m may be the buffer of res itself (addmod, submod)
+    if (r != res.digits.begin()) {
+        std::copy_n(r, len, res.digits.begin());
+    }
+    res.sign = negative && len != 0;
 }
 
-big_integer operator/(big_integer const& a, big_integer const& b) {
-    big_integer a_abs = a.abs();
-    big_integer b_abs = b.abs();
+void barrett_context::reduce(big_integer& res, big_integer const& x) const {
+    reduce_limbs(res, x.digits.begin(), x.digits.size(), x.sign, nullptr);
+}
+
+void barrett_context::mulmod(big_integer& res, big_integer const& a, big_integer const& b) const {
+    size_t na = a.digits.size();
+    size_t nb = b.digits.size();
+    if (na <= 1 && nb <= 1 && norm.size() == 1) {
+        limbs::uint128_t p = static_cast<limbs::uint128_t>(a.small_value()) * b.small_value();
+        uint64_t d = m.digits[0];
+        uint64_t r;
+        limbs::div_2_1(static_cast<uint64_t>(p >> 64) % d, static_cast<uint64_t>(p), d, r);
+        res.assign_small(r, 0, a.sign ^ b.sign);
+        return;
+    }
+    if (na == 0 || nb == 0) {
+        res.assign_small(0, 0, false);
+        return;
+    }
+    limbs::arena_frame frame;
+    // the product is reduced in its own buffer, with a spare limb for the shift
+    uint64_t* p = frame.alloc(na + nb + 1);
+    limbs::mul(p, a.digits.begin(), na, b.digits.begin(), nb);
+    reduce_limbs(res, p, na + nb, a.sign ^ b.sign, p);
+}
+
+void barrett_context::addmod(big_integer& res, big_integer const& a, big_integer const& b) const {
+    res.assign_sum(a, b, false);
+    reduce_limbs(res, res.digits.begin(), res.digits.size(), res.sign, nullptr);
+}
+
+void barrett_context::submod(big_integer& res, big_integer const& a, big_integer const& b) const {
+    res.assign_sum(a, b, true);
+    reduce_limbs(res, res.digits.begin(), res.digits.size(), res.sign, nullptr);
+}
+
+big_integer barrett_context::reduce(big_integer const& x) const {
     big_integer res;
-    big_integer dq;
-    if (a_abs < b_abs) {
-        return 0;
+    reduce(res, x);
+    return res;
+}
+
+big_integer barrett_context::mulmod(big_integer const& a, big_integer const& b) const {
+    big_integer res;
+    mulmod(res, a, b);
+    return res;
+}
+
+big_integer barrett_context::addmod(big_integer const& a, big_integer const& b) const {
+    big_integer res;
+    addmod(res, a, b);
+    return res;
+}
+
+big_integer barrett_context::submod(big_integer const& a, big_integer const& b) const {
+    big_integer res;
+    submod(res, a, b);
+    return res;
+}
+
+// *this = a + b (a - b if negate_b) written into the buffer of *this. When *this is one
+// of the operands the sum is made in place by add.
+void big_integer::assign_sum(big_integer const& a, big_integer const& b, bool negate_b) {
+    if (this == &a) {
+        add(b, negate_b);
+        return;
     }
-    if (b_abs.digits.size() == 1) {
-        res = a_abs.div_short(b_abs.digits[0]);
-        if (a.sign ^ b.sign) {
-            res.negate();
+    if (this == &b) {
+        add(a, negate_b);
+        if (negate_b) {
+            negate();
         }
+        return;
+    }
+    size_t n = a.digits.size();
+    size_t m = b.digits.size();
+    bool b_sign = b.sign ^ negate_b;
+    if (n <= 1 && m <= 1) {
+        uint64_t x = a.small_value();
+        uint64_t y = b.small_value();
+        if (a.sign == b_sign) {
+            uint64_t s;
+            bool carry = __builtin_add_overflow(x, y, &s);
+            assign_small(s, carry, a.sign);
+        } else if (x >= y) {
+            assign_small(x - y, 0, a.sign);
+        } else {
+            assign_small(y - x, 0, b_sign);
+        }
+        return;
+    }
+    if (a.sign == b_sign) {
+        size_t len = std::max(n, m);
+        digits.resize(len + 1);
+        uint64_t* d = digits.begin();
+        uint64_t const* ad = a.digits.begin();
+        uint64_t const* bd = b.digits.begin();
+        d[len] = (n >= m ? limbs::add(d, ad, n, bd, m) : limbs::add(d, bd, m, ad, n));
+        sign = a.sign;
+    } else if (limbs::cmp(a.digits.begin(), n, b.digits.begin(), m) >= 0) {
+        digits.resize(n);
+        limbs::sub(digits.begin(), a.digits.begin(), n, b.digits.begin(), m);
+        sign = a.sign;
+    } else {
+        digits.resize(m);
+        limbs::sub(digits.begin(), b.digits.begin(), m, a.digits.begin(), n);
+        sign = b_sign;
+    }
+    format();
+}
+
+// *this = a * b written into the buffer of *this, through *= when *this is one of the operands
+void big_integer::assign_product(big_integer const& a, big_integer const& b) {
+    if (this == &a || this == &b) {
+        *this *= (this == &a ? b : a);
+        return;
+    }
+    size_t n = a.digits.size();
+    size_t m = b.digits.size();
+    if (n <= 1 && m <= 1) {
+        limbs::uint128_t p = static_cast<limbs::uint128_t>(a.small_value()) * b.small_value();
+        assign_small(static_cast<uint64_t>(p), static_cast<uint64_t>(p >> 64), a.sign ^ b.sign);
+        return;
+    }
+    if (n == 0 || m == 0) {
+        assign_small(0, 0, false);
+        return;
+    }
+    digits.resize(n + m);
+    if (n == m && a.digits.begin() == b.digits.begin()) {
+        limbs::sqr(digits.begin(), a.digits.begin(), n);
+    } else {
+        limbs::mul(digits.begin(), a.digits.begin(), n, b.digits.begin(), m);
+    }
+    sign = a.sign ^ b.sign;
+    format();
+}
+
+namespace {
+    // A batch is split into chunks of at least this many elements for the worker threads
+    constexpr size_t BATCH_GRAIN = 256;
+
+    // prepare(i) and then f(i) for i < count, in chunks over the worker threads if there are
+    // any. Every chunk prepares all of its elements before it runs f on any of them.
+    template<typename Prepare, typename F>
+    void for_batch(size_t count, Prepare const& prepare, F const& f) {
+        auto run = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                prepare(i);
+            }
+            for (size_t i = begin; i < end; i++) {
+                f(i);
+            }
+        };
+        size_t chunks = std::min(count / BATCH_GRAIN, 4 * limbs::threads());
+        if (chunks <= 1) {
+            run(0, count);
+            return;
+        }
+        limbs::parallel_for(chunks, [&](size_t c) {
+            run(count * c / chunks, count * (c + 1) / chunks);
+        });
+    }
+}
+
+// The outputs are sized for their results in one pass before any sum or product is made.
+// Results that fit inline and outputs that are also operands (made in place) are left alone.
+void add_n(big_integer* out, big_integer const* a, big_integer const* b, size_t count) {
+    for_batch(count, [=](size_t i) {
+        size_t len = std::max(a[i].digits.size(), b[i].digits.size());
+        if (len > 1 && &out[i] != &a[i] && &out[i] != &b[i]) {
+            out[i].digits.reserve(len + 1);
+        }
+    }, [=](size_t i) {
+        out[i].assign_sum(a[i], b[i], false);
+    });
+}
+
+void sub_n(big_integer* out, big_integer const* a, big_integer const* b, size_t count) {
+    for_batch(count, [=](size_t i) {
+        size_t len = std::max(a[i].digits.size(), b[i].digits.size());
+        if (len > 1 && &out[i] != &a[i] && &out[i] != &b[i]) {
+            out[i].digits.reserve(len + 1);
+        }
+    }, [=](size_t i) {
+        out[i].assign_sum(a[i], b[i], true);
+    });
+}
+
+void mul_n(big_integer* out, big_integer const* a, big_integer const* b, size_t count) {
+    for_batch(count, [=](size_t i) {
+        size_t n = a[i].digits.size();
+        size_t m = b[i].digits.size();
+        if (n != 0 && m != 0 && n + m > 2 && &out[i] != &a[i] && &out[i] != &b[i]) {
+            out[i].digits.reserve(n + m);
+        }
+    }, [=](size_t i) {
+        out[i].assign_product(a[i], b[i]);
+    });
+}
+
+// The halves of a subtree go to two tasks when there are worker threads and it holds
+// enough limbs. A single value is copied limb by limb: a COW copy would touch the reference
+// count, which another task may do at the same time for another copy of the same value.
+big_integer big_integer::reduce_tree(big_integer const* v, size_t n, bool multiply) {
+    big_integer res;
+    if (n == 0) {
+        res.assign_small(multiply ? 1 : 0, 0, false);
+        return res;
+    }
+    if (n == 1) {
+        limb_vector const& d = v[0].digits;
+        res.digits.resize(d.size());
+        std::copy_n(d.begin(), d.size(), res.digits.begin());
+        res.sign = v[0].sign;
         return res;
     }
-    a_abs.digits.push_back(0);
-    size_t m = b_abs.digits.size() + 1;
-    size_t n = a_abs.digits.size();
-    res.digits.resize(n - m + 1);
-    uint32_t qt = 0;
-    for (size_t i = m, j = res.digits.size() - 1; i <= n; i++, j--) {
-        uint128_t x = shift_or_128(a_abs.digits, 3);
-        uint128_t y = shift_or_128(b_abs.digits, 2);
-        qt = static_cast<uint32_t>(std::min(static_cast<uint128_t>(UINT32_MAX), x / y));
-        dq = b_abs * qt;
-        if (!a_abs.less(dq.abs(), m)) {
-            qt--;
-            dq -= b_abs;
+    size_t h = n / 2;
+    big_integer right;
+    size_t limb_count = 0;
+    if (limbs::threads() > 1) {
+        for (size_t i = 0; i < n && limb_count < limbs::PARALLEL_THRESHOLD; i++) {
+            limb_count += v[i].digits.size();
         }
-        res.digits[j] = qt;
-        a_abs.diff(dq.abs(), m);
-        if (a_abs.digits.back() == 0) {
-            a_abs.digits.pop_back();
+    }
+    if (limb_count >= limbs::PARALLEL_THRESHOLD) {
+        limbs::parallel_for(2, [&](size_t i) {
+            if (i == 0) {
+                res = reduce_tree(v, h, multiply);
+            } else {
+                right = reduce_tree(v + h, n - h, multiply);
+            }
+        });
+    } else {
+        res = reduce_tree(v, h, multiply);
+        right = reduce_tree(v + h, n - h, multiply);
+    }
+    if (multiply) {
+        res *= right;
+    } else {
+        res += right;
+    }
+    return res;
+}
+
+// The factors are packed into one-limb leaves, each as many as fit in 64 bits
+big_integer big_integer::product_of_limbs(std::vector<uint64_t> const& factors) {
+    std::vector<big_integer> leaves;
+    uint64_t f = 1;
+    for (uint64_t x : factors) {
+        if (f > UINT64_MAX / x) {
+            leaves.emplace_back();
+            leaves.back().assign_small(f, 0, false);
+            f = 1;
         }
+        f *= x;
     }
-    res.format();
-    if (a.sign ^ b.sign) {
-        res.negate();
+    leaves.emplace_back();
+    leaves.back().assign_small(f, 0, false);
+    return reduce_tree(leaves.data(), leaves.size(), true);
+}
+
+big_integer product(std::vector<big_integer> const& values) {
+    return big_integer::reduce_tree(values.data(), values.size(), true);
+}
+
+big_integer sum(std::vector<big_integer> const& values) {
+    return big_integer::reduce_tree(values.data(), values.size(), false);
+}
+
+namespace {
+    // binomial sieves up to n only when k is at least n / BINOMIAL_SIEVE_RATIO. Below that
+    // the product and the division by k! measured faster for n up to 10^8.
+    constexpr uint32_t BINOMIAL_SIEVE_RATIO = 1024;
+}
+
+// The powers of two are taken out of the factors and applied as one shift
+big_integer factorial(uint32_t n) {
+    std::vector<uint64_t> factors;
+    int shift = 0;
+    for (uint64_t i = 2; i <= n; i++) {
+        unsigned zeros = __builtin_ctzll(i);
+        shift += zeros;
+        if ((i >> zeros) > 1) {
+            factors.push_back(i >> zeros);
+        }
     }
+    big_integer res = big_integer::product_of_limbs(factors);
+    res <<= shift;
     return res;
 }
 
-big_integer operator%(big_integer const& a, big_integer const& b) {
-    return a - (a / b) * b;
+// A small k gives (n - k + 1) ... n / k!, which needs no sieve up to n. Otherwise Kummer:
+// the exponent of a prime p is the sum over its powers q of floor(n / q) - floor(k / q) - floor((n - k) / q)
+big_integer binomial(uint32_t n, uint32_t k) {
+    if (k > n) {
+        return 0;
+    }
+    k = std::min(k, n - k);
+    if (k < n / BINOMIAL_SIEVE_RATIO) {
+        std::vector<uint64_t> factors;
+        for (uint64_t i = uint64_t(n) - k + 1; i <= n; i++) {
+            factors.push_back(i);
+        }
+        return big_integer::product_of_limbs(factors) / factorial(k);
+    }
+    std::vector<bool> composite(static_cast<size_t>(n) + 1);
+    std::vector<uint64_t> factors;
+    for (uint64_t p = 2; p <= n; p++) {
+        if (composite[p]) {
+            continue;
+        }
+        for (uint64_t j = p * p; j <= n; j += p) {
+            composite[j] = true;
+        }
+        for (uint64_t q = p; q <= n; q *= p) {
+            for (uint64_t e = n / q - k / q - (n - k) / q; e > 0; e--) {
+                factors.push_back(p);
+            }
+        }
+    }
+    return big_integer::product_of_limbs(factors);
 }
 
-big_integer operator>>(big_integer const& a, int b) {
-    big_integer res = a;
-    int k = b / 32;
-    b %= 32;
-    for (size_t i = k; i < res.digits.size(); i++) {
-        res.digits[i - k] = res.digits[i];
+// Quotient rounded towards zero and remainder with the sign of a, from one division
+std::pair<big_integer, big_integer> divmod(big_integer const& a, big_integer const& b) {
+    size_t n = a.digits.size();
+    size_t m = b.digits.size();
+    if (n <= 1 && m == 1) {
+        uint64_t x = a.small_value();
+        uint64_t y = b.digits[0];
+        big_integer q, r;
+        q.assign_small(x / y, 0, a.sign ^ b.sign);
+        r.assign_small(x % y, 0, a.sign);
+        return {std::move(q), std::move(r)};
     }
-    res.digits.resize(res.digits.size() - k);
-    res.format();
-    big_integer shifted_b = (static_cast<uint32_t>(1) << b);
-    res /= shifted_b;
-    if (res < 0 && res * shifted_b != a) {
-        res--;
+    if (limbs::cmp(a.digits.begin(), n, b.digits.begin(), m) < 0) {
+        return {0, a};
     }
-    return res;
+    big_integer q, r;
+    q.digits.resize(n - m + 1);
+    r.digits.resize(m);
+    limbs::divrem(q.digits.begin(), r.digits.begin(), a.digits.begin(), n, b.digits.begin(), m);
+    q.sign = a.sign ^ b.sign;
+    r.sign = a.sign;
+    q.format();
+    r.format();
+    return {std::move(q), std::move(r)};
+}
+
+big_integer operator/(big_integer const& a, big_integer const& b) {
+    if (a.is_small() && b.is_small()) {
+        big_integer q;
+        q.assign_small(a.small_value() / b.small_value(), 0, a.sign ^ b.sign);
+        return q;
+    }
+    return divmod(a, b).first;
+}
+
+big_integer operator%(big_integer const& a, big_integer const& b) {
+    if (a.is_small() && b.is_small()) {
+        big_integer r;
+        r.assign_small(a.small_value() % b.small_value(), 0, a.sign);
+        return r;
+    }
+    return divmod(a, b).second;
+}
+
+big_integer operator>>(big_integer a, int b) {
+    a >>= b;
+    return a;
 }
 
 big_integer operator<<(big_integer a, int b) {
-    return a <<= b;
+    a <<= b;
+    return a;
 }
 
 big_integer operator|(big_integer a, big_integer const& b) {
-    return a |= b;
+    a |= b;
+    return a;
+}
+
+big_integer operator|(big_integer const& a, big_integer&& b) {
+    b |= a;
+    return std::move(b);
 }
 
 big_integer operator&(big_integer a, big_integer const& b) {
-    return a &= b;
+    a &= b;
+    return a;
+}
+
+big_integer operator&(big_integer const& a, big_integer&& b) {
+    b &= a;
+    return std::move(b);
 }
 
 big_integer operator^(big_integer a, big_integer const& b) {
-    return a ^= b;
+    a ^= b;
+    return a;
+}
+
+big_integer operator^(big_integer const& a, big_integer&& b) {
+    b ^= a;
+    return std::move(b);
 }
 
 big_integer& big_integer::operator+=(big_integer const& x) {
@@ -404,49 +863,144 @@ big_integer& big_integer::operator-=(big_integer const& x) {
     return *this;
 }
 
+big_integer& big_integer::operator+=(product const& x) {
+    add_product(*this, x.a, x.b, false);
+    return *this;
+}
+
+big_integer& big_integer::operator-=(product const& x) {
+    add_product(*this, x.a, x.b, true);
+    return *this;
+}
+
+// The compound operators reuse the buffer of *this: a one-limb factor is multiplied in place,
+// otherwise the result is formed in the arena and copied back.
 big_integer& big_integer::operator*=(big_integer const& x) {
-    return *this = *this * x;
+    limb_vector const& cd = digits;
+    size_t n = cd.size();
+    size_t m = x.digits.size();
+    if (n == 0 || m == 0) {
+        digits.resize(0);
+        sign = false;
+        return *this;
+    }
+    if (n == 1 && m == 1) {
+        limbs::uint128_t p = static_cast<limbs::uint128_t>(cd[0]) * x.digits[0];
+        assign_small(static_cast<uint64_t>(p), static_cast<uint64_t>(p >> 64), sign ^ x.sign);
+        return *this;
+    }
+    sign ^= x.sign;
+    if (m == 1) {
+        uint64_t k = x.digits[0];
+        digits.resize(n + 1);
+        uint64_t* d = digits.begin();
+        d[n] = limbs::mul_1(d, d, n, k);
+    } else {
+        limbs::arena_frame frame;
+        uint64_t* p = frame.alloc(n + m);
+        if (n == m && cd.begin() == x.digits.begin()) {
+            limbs::sqr(p, cd.begin(), n);
+        } else {
+            limbs::mul(p, cd.begin(), n, x.digits.begin(), m);
+        }
+        digits.resize(n + m);
+        std::copy_n(p, n + m, digits.begin());
+    }
+    format();
+    return *this;
 }
 
 big_integer& big_integer::operator/=(big_integer const& x) {
-    return *this = *this / x;
+    limb_vector const& cd = digits;
+    size_t n = cd.size();
+    size_t m = x.digits.size();
+    if (n <= 1 && m <= 1) {
+        assign_small(small_value() / x.small_value(), 0, sign ^ x.sign);
+        return *this;
+    }
+    if (limbs::cmp(cd.begin(), n, x.digits.begin(), m) < 0) {
+        digits.resize(0);
+        sign = false;
+        return *this;
+    }
+    limbs::arena_frame frame;
+    uint64_t* q = frame.alloc(n - m + 1);
+    limbs::divrem(q, frame.alloc(m), cd.begin(), n, x.digits.begin(), m, frame.alloc(n + m + 1));
+    digits.resize(n - m + 1);
+    std::copy_n(q, n - m + 1, digits.begin());
+    sign ^= x.sign;
+    format();
+    return *this;
 }
 
+// The remainder is written over the dividend
 big_integer& big_integer::operator%=(big_integer const& x) {
-    return *this = *this % x;
+    size_t n = digits.size();
+    size_t m = x.digits.size();
+    if (n <= 1 && m <= 1) {
+        assign_small(small_value() % x.small_value(), 0, sign);
+        return *this;
+    }
+    uint64_t* d = digits.begin();
+    if (limbs::cmp(d, n, x.digits.begin(), m) < 0) {
+        return *this;
+    }
+    limbs::arena_frame frame;
+    limbs::divrem(frame.alloc(n - m + 1), d, d, n, x.digits.begin(), m, frame.alloc(n + m + 1));
+    digits.resize(m);
+    format();
+    return *this;
 }
 
 big_integer& big_integer::operator|=(big_integer const& x) {
-    bit_op(x, _or);
+    bit_op(x, std::bit_or<uint64_t>(), limbs::or_n);
     return *this;
 }
 
 big_integer& big_integer::operator&=(big_integer const& x) {
-    bit_op(x, _and);
+    bit_op(x, std::bit_and<uint64_t>(), limbs::and_n);
     return *this;
 }
 
 big_integer& big_integer::operator^=(big_integer const& x) {
-    bit_op(x, _xor);
+    bit_op(x, std::bit_xor<uint64_t>(), limbs::xor_n);
     return *this;
 }
 
+// Shift of the magnitude. For negatives the result is rounded towards minus infinity,
+// as an arithmetic shift of the two's complement would, by adding one when any bit is lost.
 big_integer& big_integer::operator>>=(int b) {
-    return *this = *this >> b;
+    size_t k = b / 64;
+    unsigned s = b % 64;
+    size_t n = digits.size();
+    if (k >= n) {
+        return *this = (sign ? -1 : 0);
+    }
+    bool negative = sign;
+    uint64_t* d = digits.begin();
+    bool lost = limbs::normalized(d, k) != 0;
+    lost |= limbs::rshift(d, d + k, n - k, s) != 0;
+    digits.resize(n - k);
+    format();
+    if (negative && lost) {
+        sign = true;
+        add(1, true);
+    }
+    return *this;
 }
 
 big_integer& big_integer::operator<<=(int b) {
-    int k = b / 32;
-    b %= 32;
-    convert(digits.size() + k);
-    for (size_t i = digits.size(); i > static_cast<size_t>(k); i--) {
-        digits[i - 1] = digits[i - k - 1];
-    }
-    for (size_t i = 0; i < static_cast<size_t>(k); i++) {
-        digits[i] = 0;
+    size_t k = b / 64;
+    unsigned s = b % 64;
+    size_t n = digits.size();
+    if (n == 0) {
+        return *this;
     }
+    digits.resize(n + k + 1);
+    uint64_t* d = digits.begin();
+    d[n + k] = limbs::lshift(d + k, d, n, s);
+    std::fill_n(d, k, 0);
     format();
-    *this *= (static_cast<uint32_t>(1) << b);
     return *this;
 }
 
@@ -469,29 +1023,16 @@ bool operator!=(big_integer const& a, big_integer const& b) {
 bool operator<(big_integer const& a, big_integer const& b) {
     if (a.sign != b.sign) {
         return a.sign;
-    } else if (a.digits.size() != b.digits.size()) {
-        return (a.digits.size() < b.digits.size()) ^ a.sign;
     }
-    for (size_t i = a.digits.size(); i > 0; i--) {
-        if (a.digits[i - 1] != b.digits[i - 1]) {
-            return a.digits[i - 1] < b.digits[i - 1];
-        }
+    if (a.is_small() && b.is_small()) {
+        return a.sign ? a.small_value() > b.small_value() : a.small_value() < b.small_value();
     }
-    return false;
+    int c = limbs::cmp(a.digits.begin(), a.digits.size(), b.digits.begin(), b.digits.size());
+    return a.sign ? c > 0 : c < 0;
 }
 
 bool operator>(big_integer const& a, big_integer const& b) {
-    if (a.sign != b.sign) {
-        return !a.sign;
-    } else if (a.digits.size() != b.digits.size()) {
-        return (a.digits.size() > b.digits.size()) ^ a.sign;
-    }
-    for (size_t i = a.digits.size(); i > 0; i--) {
-        if (a.digits[i - 1] != b.digits[i - 1]) {
-            return a.digits[i - 1] > b.digits[i - 1];
-        }
-    }
-    return false;
+    return b < a;
 }
 
 bool operator<=(big_integer const& a, big_integer const& b) {
@@ -6,17 +6,36 @@
 #include <functional>
 #include "opt_vector.h"
 
+// Number of limbs stored inline in a big_integer, larger values go to a heap buffer.
+// Like BIG_INTEGER_EXPRESSION_TEMPLATES it is set for the whole build (BIGINT_INLINE_LIMBS in CMake).
+#ifndef BIG_INTEGER_INLINE_LIMBS
+#define BIG_INTEGER_INLINE_LIMBS 1
+#endif
+
 struct big_integer {
 private:
-    opt_vector digits;
+    // With BIG_INTEGER_ATOMIC_REFCOUNT defined (BIGINT_ATOMIC_REFCOUNT in CMake) copies of one
+    // big_integer, such as a constant shared by worker threads, may be used and destroyed
+    // concurrently. Concurrent writes to one big_integer object are still a race.
+#ifdef BIG_INTEGER_ATOMIC_REFCOUNT
+    typedef basic_opt_vector<BIG_INTEGER_INLINE_LIMBS, true> limb_vector;
+#else
+    typedef basic_opt_vector<BIG_INTEGER_INLINE_LIMBS> limb_vector;
+#endif
+
+    // Sign and magnitude: digits has no leading zero limbs, zero is never negative.
+    // Two's complement only appears inside bitwise operations and >>.
+    limb_vector digits;
     bool sign;
 public:
     big_integer();
     big_integer(const big_integer&) = default;
+    big_integer(big_integer&&) noexcept;
     big_integer(uint32_t);
     big_integer(int);
     explicit big_integer(std::string const&);
     big_integer& operator=(big_integer const&) = default;
+    big_integer& operator=(big_integer&&) noexcept;
 
     friend std::string to_string(big_integer const&);
 
@@ -28,10 +47,21 @@ public:
     big_integer& operator--();
     big_integer operator--(int);
 
+    // Lazy a * b, see BIG_INTEGER_EXPRESSION_TEMPLATES below
+    class product;
+
+#ifdef BIG_INTEGER_EXPRESSION_TEMPLATES
+    friend product operator*(big_integer const&, big_integer const&);
+#else
     friend big_integer operator*(big_integer const&, big_integer const&);
+#endif
     friend big_integer operator/(big_integer const&, big_integer const&);
+    friend big_integer operator%(big_integer const&, big_integer const&);
+    friend std::pair<big_integer, big_integer> divmod(big_integer const&, big_integer const&);
 
-    friend big_integer operator>>(big_integer const&, int);
+    friend big_integer operator-(big_integer const&, big_integer&&);
+
+    friend big_integer operator>>(big_integer, int);
     friend big_integer operator<<(big_integer, int);
 
     friend big_integer operator|(big_integer, big_integer const&);
@@ -40,6 +70,8 @@ public:
 
     big_integer& operator+=(big_integer const&);
     big_integer& operator-=(big_integer const&);
+    big_integer& operator+=(product const&);
+    big_integer& operator-=(product const&);
     big_integer& operator*=(big_integer const&);
     big_integer& operator/=(big_integer const&);
     big_integer& operator%=(big_integer const&);
@@ -55,22 +87,191 @@ public:
     friend bool operator<=(big_integer const&, big_integer const&);
     friend bool operator>=(big_integer const&, big_integer const&);
 
+    // Fused kernels: acc += a * b and acc -= a * b without a temporary big_integer
+    // (the product of short operands is accumulated straight into acc), and a * b % m
+    // dividing the product limbs in place.
+    friend void addmul(big_integer& acc, big_integer const& a, big_integer const& b);
+    friend void submul(big_integer& acc, big_integer const& a, big_integer const& b);
+    friend big_integer mulmod(big_integer const& a, big_integer const& b, big_integer const& m);
+
+    // base^exp % mod with the sign rule of %, negative only for a negative base and an odd exp.
+    // A negative exp or a zero mod throws std::domain_error. Odd moduli go through Montgomery
+    // multiplication, even ones divide every product.
+    friend big_integer powmod(big_integer const& base, big_integer const& exp, big_integer const& mod);
+
+    // Batch forms: out[i] = a[i] + b[i] (a[i] - b[i], a[i] * b[i]) for i < count, without
+    // temporaries. Each result is written straight into the buffer of out[i], so a batch repeated
+    // into the same out does not allocate. The out[i] are sized for their results in one pass
+    // before the kernels run, but each keeps a COW buffer of its own: a fresh out still costs
+    // one allocation per result that does not fit inline. out may be a or b. With worker threads
+    // (limbs::set_threads) long batches are split into chunks over them; then no two of
+    // the out[i] may be copies of each other or of an a[j], b[j] at another index,
+    // unless BIG_INTEGER_ATOMIC_REFCOUNT is defined.
+    friend void add_n(big_integer* out, big_integer const* a, big_integer const* b, size_t count);
+    friend void sub_n(big_integer* out, big_integer const* a, big_integer const* b, size_t count);
+    friend void mul_n(big_integer* out, big_integer const* a, big_integer const* b, size_t count);
+
+    // Product and sum of all values by a balanced binary tree, so that the operands of each
+    // multiplication are of similar size and the fast tiers apply. With worker threads the halves
+    // of a subtree of limbs::PARALLEL_THRESHOLD limbs or more are reduced in parallel.
+    // The product of no values is 1, the sum is 0.
+    friend big_integer product(std::vector<big_integer> const& values);
+    friend big_integer sum(std::vector<big_integer> const& values);
+
+    // n! and n! / (k! (n - k)!) (zero for k > n) as products of one-limb factors in a tree,
+    // the binomial from its prime factorization, or for a k much smaller than n (or n - k)
+    // as (n - k + 1) ... n / k!
+    friend big_integer factorial(uint32_t n);
+    friend big_integer binomial(uint32_t n, uint32_t k);
+
+    friend class barrett_context;
+
 private:
-    void convert(size_t);
+    // Values below 2^64 in magnitude live in the inline limb of digits. Arithmetic on two
+    // such values goes through native 64-bit and 128-bit operations instead of the limb kernels.
+    bool is_small() const {
+        return digits.size() <= 1;
+    }
+
+    uint64_t small_value() const {
+        return digits.empty() ? 0 : digits[0];
+    }
+
+    void assign_small(uint64_t low, uint64_t high, bool negative);
     void format();
-    big_integer abs() const;
-    bool less(big_integer const&, size_t) const;
-    void diff(big_integer const&, size_t);
-    big_integer div_short(uint32_t) const;
-    void bit_op(big_integer const&, const std::function<uint32_t(uint32_t, uint32_t)>&);
-    void append_substr(std::string const&);
+    typedef void (*bit_kernel)(uint64_t*, uint64_t const*, uint64_t const*, size_t);
+    template<typename Op>
+    void bit_op(big_integer const&, Op, bit_kernel);
     void tilde();
     void negate();
-    uint32_t get(size_t) const;
     void add(big_integer const&, bool);
+    void assign_sum(big_integer const&, big_integer const&, bool);
+    void assign_product(big_integer const&, big_integer const&);
+    static big_integer multiply(big_integer const&, big_integer const&);
+    static void add_product(big_integer&, big_integer const&, big_integer const&, bool);
+    static big_integer product_of_limbs(std::vector<uint64_t> const&);
+    static big_integer reduce_tree(big_integer const*, size_t, bool);
 };
 
+// With BIG_INTEGER_EXPRESSION_TEMPLATES defined (for the whole build, the library and every
+// user must agree) a * b is a product that remembers its operands, and the shapes
+// acc += a * b, acc -= a * b, a * b + c, c + a * b, c - a * b and a * b % m go to the fused kernels.
+// Any other use converts it to big_integer. The operands are held by reference,
+// so a product must not outlive the full expression (no `auto p = a * b;`).
+class big_integer::product {
+public:
+    product(big_integer const& a, big_integer const& b): a(a), b(b) {}
+
+    operator big_integer() const {
+        return multiply(a, b);
+    }
+
+    big_integer operator-() const {
+        return -multiply(a, b);
+    }
+
+    friend big_integer operator+(product const& p, big_integer c) {
+        addmul(c, p.a, p.b);
+        return c;
+    }
+
+    friend big_integer operator+(big_integer c, product const& p) {
+        addmul(c, p.a, p.b);
+        return c;
+    }
+
+    friend big_integer operator+(product const& p, product const& q) {
+        return p + big_integer(q);
+    }
+
+    friend big_integer operator-(big_integer c, product const& p) {
+        submul(c, p.a, p.b);
+        return c;
+    }
+
+    friend big_integer operator%(product const& p, big_integer const& m) {
+        return mulmod(p.a, p.b, m);
+    }
+
+    friend big_integer& big_integer::operator+=(product const&);
+    friend big_integer& big_integer::operator-=(product const&);
+
+private:
+    big_integer const& a;
+    big_integer const& b;
+};
+
+// Reduction by a fixed modulus m, a zero m throws std::domain_error. The modulus shifted to a set top bit (and, from
+// limbs::BARRETT_THRESHOLD limbs on, its reciprocal) is computed once and every call divides
+// by it in the arena. Each result equals the expression followed by % m, with the sign rule of %.
+// The forms taking res write into its buffer, so they do not allocate once it is large enough.
+class barrett_context {
+public:
+    explicit barrett_context(big_integer const& m);
+
+    big_integer const& modulus() const {
+        return m;
+    }
+
+    // x % m
+    void reduce(big_integer& res, big_integer const& x) const;
+    // a * b % m
+    void mulmod(big_integer& res, big_integer const& a, big_integer const& b) const;
+    // (a + b) % m and (a - b) % m, one subtraction of m when the operands are already reduced
+    void addmod(big_integer& res, big_integer const& a, big_integer const& b) const;
+    void submod(big_integer& res, big_integer const& a, big_integer const& b) const;
+
+    big_integer reduce(big_integer const& x) const;
+    big_integer mulmod(big_integer const& a, big_integer const& b) const;
+    big_integer addmod(big_integer const& a, big_integer const& b) const;
+    big_integer submod(big_integer const& a, big_integer const& b) const;
+
+private:
+    big_integer m;
+    unsigned shift;
+    // m << shift and floor(B^2n / (m << shift)) for a modulus of n limbs
+    std::vector<uint64_t> norm;
+    std::vector<uint64_t> inv;
+
+    void reduce_limbs(big_integer& res, uint64_t const* x, size_t n, bool negative, uint64_t* w) const;
+};
+
+#ifdef BIG_INTEGER_EXPRESSION_TEMPLATES
+inline big_integer::product operator*(big_integer const& a, big_integer const& b) {
+    return big_integer::product(a, b);
+}
+#endif
+
+// The overloads taking an rvalue on the right reuse its buffer for the result
 big_integer operator+(big_integer, big_integer const&);
+big_integer operator+(big_integer const&, big_integer&&);
 big_integer operator-(big_integer, big_integer const&);
+big_integer operator-(big_integer const&, big_integer&&);
+big_integer operator|(big_integer const&, big_integer&&);
+big_integer operator&(big_integer const&, big_integer&&);
+big_integer operator^(big_integer const&, big_integer&&);
 big_integer operator%(big_integer const&, big_integer const&);
-bool operator!=(big_integer const&, big_integer const&);
\ No newline at end of file
+std::pair<big_integer, big_integer> divmod(big_integer const&, big_integer const&);
+void addmul(big_integer&, big_integer const&, big_integer const&);
+void submul(big_integer&, big_integer const&, big_integer const&);
+big_integer mulmod(big_integer const&, big_integer const&, big_integer const&);
+big_integer powmod(big_integer const&, big_integer const&, big_integer const&);
+void add_n(big_integer*, big_integer const*, big_integer const*, size_t);
+void sub_n(big_integer*, big_integer const*, big_integer const*, size_t);
+void mul_n(big_integer*, big_integer const*, big_integer const*, size_t);
+big_integer product(std::vector<big_integer> const&);
+big_integer sum(std::vector<big_integer> const&);
+big_integer factorial(uint32_t);
+big_integer binomial(uint32_t, uint32_t);
+bool operator!=(big_integer const&, big_integer const&);
+
+// Product and sum of any range of values convertible to big_integer
+template<typename It>
+big_integer product(It first, It last) {
+    return product(std::vector<big_integer>(first, last));
+}
+
+template<typename It>
+big_integer sum(It first, It last) {
+    return sum(std::vector<big_integer>(first, last));
+}
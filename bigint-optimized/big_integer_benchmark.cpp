@@ -0,0 +1,476 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "big_integer.h"
+#include "limbs.h"
+
+// Every heap allocation of the benchmark is counted, see bench_allocations. Worker threads
+// allocate too, so the counter is atomic.
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(n == 0 ? 1 : n))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+std::mt19937_64 rng(42);
+
+std::vector<uint64_t> random_limbs(size_t n) {
+  std::vector<uint64_t> res(n);
+  for (auto& x : res)
+    x = rng();
+  return res;
+}
+
+// Time of one call of f in microseconds: the best of several rounds of ~10ms each
+template<typename F>
+double measure(F&& f) {
+  using clock = std::chrono::steady_clock;
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    size_t iterations = 0;
+    auto start = clock::now();
+    auto elapsed = clock::duration::zero();
+    do {
+      f();
+      iterations++;
+      elapsed = clock::now() - start;
+    } while (elapsed < std::chrono::milliseconds(10));
+    double t = std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+    if (round == 0 || t < best)
+      best = t;
+  }
+  return best;
+}
+
+void bench_mul() {
+  std::printf("multiplication, n x n limbs (us per call)\n");
+  std::printf("%8s %14s %14s %8s\n", "n", "schoolbook", "limbs::mul", "speedup");
+  size_t const sizes[] = {8, 16, 24, 32, 40, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 2048, 4096, 8192};
+  for (size_t n : sizes) {
+    std::vector<uint64_t> a = random_limbs(n), b = random_limbs(n), res(2 * n);
+    double basecase = measure([&] { limbs::mul_basecase(res.data(), a.data(), n, b.data(), n); });
+    double dispatched = measure([&] { limbs::mul(res.data(), a.data(), n, b.data(), n); });
+    std::printf("%8zu %14.2f %14.2f %8.2f\n", n, basecase, dispatched, basecase / dispatched);
+  }
+}
+
+void bench_sqr() {
+  std::printf("squaring, n limbs (us per call)\n");
+  std::printf("%8s %14s %14s %8s\n", "n", "limbs::mul", "limbs::sqr", "speedup");
+  size_t const sizes[] = {8, 32, 64, 128, 512, 1024, 4096, 16384};
+  for (size_t n : sizes) {
+    std::vector<uint64_t> a = random_limbs(n), b = a, res(2 * n);
+    double general = measure([&] { limbs::mul(res.data(), a.data(), n, b.data(), n); });
+    double square = measure([&] { limbs::sqr(res.data(), a.data(), n); });
+    std::printf("%8zu %14.2f %14.2f %8.2f\n", n, general, square, general / square);
+  }
+}
+
+void bench_mul_huge() {
+  std::printf("multiplication of huge operands, n x n limbs\n");
+  std::printf("%8s %14s %14s\n", "n", "ms", "ns per limb");
+  for (size_t n = 1 << 12; n <= (1 << 20); n *= 4) {
+    std::vector<uint64_t> a = random_limbs(n), b = random_limbs(n), res(2 * n);
+    double us = measure([&] { limbs::mul(res.data(), a.data(), n, b.data(), n); });
+    std::printf("%8zu %14.2f %14.2f\n", n, us / 1000, us * 1000 / n);
+  }
+}
+
+void bench_div() {
+  std::printf("division, 2n by n limbs (us per call)\n");
+  std::printf("%8s %14s %14s %8s\n", "n", "schoolbook", "limbs::divrem", "speedup");
+  size_t const sizes[] = {16, 32, 48, 64, 96, 128, 256, 512, 1024, 2048, 4096, 8192};
+  for (size_t n : sizes) {
+    std::vector<uint64_t> a = random_limbs(2 * n), b = random_limbs(n), q(n + 1), r(n), work(2 * n + 1);
+    b[n - 1] |= 1ull << 63;
+    double basecase = measure([&] {
+      std::copy(a.begin(), a.end(), work.begin());
+      limbs::divrem_basecase(q.data(), work.data(), 2 * n + 1, b.data(), n);
+    });
+    double dispatched = measure([&] { limbs::divrem(q.data(), r.data(), a.data(), 2 * n, b.data(), n); });
+    std::printf("%8zu %14.2f %14.2f %8.2f\n", n, basecase, dispatched, basecase / dispatched);
+  }
+}
+
+void bench_div_huge() {
+  std::printf("division of huge operands, 4n by n limbs (ms per call)\n");
+  std::printf("%8s %14s %14s %8s\n", "n", "Burnikel-Z", "Newton", "speedup");
+  for (size_t n = 1 << 12; n <= (1 << 17); n *= 2) {
+    std::vector<uint64_t> a = random_limbs(4 * n), b = random_limbs(n), q(3 * n + 1), work(4 * n + 1);
+    b[n - 1] |= 1ull << 63;
+    double bz = measure([&] {
+      std::copy(a.begin(), a.end(), work.begin());
+      limbs::divrem_bz(q.data(), work.data(), 4 * n + 1, b.data(), n);
+    });
+    double newton = measure([&] {
+      std::copy(a.begin(), a.end(), work.begin());
+      limbs::divrem_newton(q.data(), work.data(), 4 * n + 1, b.data(), n);
+    });
+    std::printf("%8zu %14.2f %14.2f %8.2f\n", n, bz / 1000, newton / 1000, bz / newton);
+  }
+}
+
+void bench_to_decimal() {
+  std::printf("conversion to decimal, n limbs\n");
+  std::printf("%8s %14s %14s\n", "n", "ms", "ns per digit");
+  for (size_t n = 16; n <= (1 << 16); n *= 4) {
+    std::vector<uint64_t> a = random_limbs(n);
+    size_t digits = limbs::to_decimal(a.data(), n).size();
+    double us = measure([&] { limbs::to_decimal(a.data(), n); });
+    std::printf("%8zu %14.3f %14.2f\n", n, us / 1000, us * 1000 / digits);
+  }
+}
+
+void bench_from_decimal() {
+  std::printf("conversion from decimal, n limbs\n");
+  std::printf("%8s %14s %14s\n", "n", "ms", "ns per digit");
+  for (size_t n = 16; n <= (1 << 16); n *= 4) {
+    std::vector<uint64_t> a = random_limbs(n);
+    std::string s = limbs::to_decimal(a.data(), n);
+    double us = measure([&] { limbs::from_decimal(s.data(), s.size()); });
+    std::printf("%8zu %14.3f %14.2f\n", n, us / 1000, us * 1000 / s.size());
+  }
+}
+
+void bench_bitwise() {
+  std::printf("bitwise operations on big_integer, n limbs (us per call)\n");
+  std::printf("%8s %14s %14s %14s\n", "n", "&", "|", "^ negative");
+  for (size_t n = 64; n <= (1 << 16); n *= 8) {
+    std::vector<uint64_t> a = random_limbs(n), b = random_limbs(n - n / 4);
+    big_integer x(limbs::to_decimal(a.data(), a.size())), y(limbs::to_decimal(b.data(), b.size()));
+    big_integer z = -y;
+    big_integer res;
+    double t_and = measure([&] { res = x & y; });
+    double t_or = measure([&] { res = x | y; });
+    double t_xor = measure([&] { res = x ^ z; });
+    std::printf("%8zu %14.2f %14.2f %14.2f\n", n, t_and, t_or, t_xor);
+  }
+}
+
+std::string random_decimal(size_t digits) {
+  std::string s(digits, '0');
+  for (auto& c : s)
+    c = static_cast<char>('0' + rng() % 10);
+  s[0] = '1';
+  return s;
+}
+
+// Sizes in bits, so that the table does not depend on the limb width
+void bench_big_integer() {
+  std::printf("big_integer operations, n-bit operands, division 2n by n bits (us per call)\n");
+  std::printf("%8s %12s %12s %12s %12s %12s\n", "bits", "a * b", "a * a", "a / b", "a % b", "to_string");
+  for (size_t bits = 1000; bits <= 1000000; bits *= 10) {
+    size_t digits = bits * 30103 / 100000;
+    big_integer a(random_decimal(digits)), b(random_decimal(digits)), c(random_decimal(2 * digits));
+    big_integer res;
+    std::string s;
+    double t_mul = measure([&] { res = a * b; });
+    double t_sqr = measure([&] { res = a * a; });
+    double t_div = measure([&] { res = c / a; });
+    double t_mod = measure([&] { res = c % a; });
+    double t_str = measure([&] { s = to_string(c); });
+    std::printf("%8zu %12.2f %12.2f %12.2f %12.2f %12.2f\n", bits, t_mul, t_sqr, t_div, t_mod, t_str);
+  }
+}
+
+// Operands that fit a limb, where the native fast paths apply. Each call runs 1000 operations,
+// so that the clock is not read once per operation.
+void bench_small() {
+  std::printf("big_integer operations on values below 2^64 (ns per operation)\n");
+  std::printf("%8s %10s %10s %10s %10s %10s %10s\n", "bits", "a + b", "a - b", "a * b", "a / b", "a % b", "a < b");
+  size_t const sizes[] = {31, 62, 64};
+  size_t const batch = 1000;
+  for (size_t bits : sizes) {
+    big_integer a = 1, b = 1;
+    a <<= static_cast<int>(bits - 1);
+    b <<= static_cast<int>(bits / 2);
+    a += big_integer(static_cast<uint32_t>(rng()));
+    b = -(b + 12345);
+    big_integer res;
+    size_t less = 0;
+    auto batched = [&](double us) { return us * 1000 / batch; };
+    double t_add = batched(measure([&] { for (size_t i = 0; i < batch; i++) res = a + b; }));
+    double t_sub = batched(measure([&] { for (size_t i = 0; i < batch; i++) res = a - b; }));
+    double t_mul = batched(measure([&] { for (size_t i = 0; i < batch; i++) res = a * b; }));
+    double t_div = batched(measure([&] { for (size_t i = 0; i < batch; i++) res = a / b; }));
+    double t_mod = batched(measure([&] { for (size_t i = 0; i < batch; i++) res = a % b; }));
+    double t_cmp = batched(measure([&] { for (size_t i = 0; i < batch; i++) less += (a < b); }));
+    std::printf("%8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", bits, t_add, t_sub, t_mul, t_div, t_mod,
+                t_cmp + 0 * static_cast<double>(less));
+  }
+}
+
+// Copies, sums, products and reductions over an array of values of a few limbs, the range where
+// BIG_INTEGER_INLINE_LIMBS decides between inline storage and heap buffers
+void bench_mix() {
+  std::printf("operation mix over 64 n-bit values, %d inline limbs (ns per value)\n", BIG_INTEGER_INLINE_LIMBS);
+  std::printf("%8s %10s %10s %10s %12s %12s\n", "bits", "copy", "sum", "a * b", "a * b % m", "a * b + c");
+  size_t const sizes[] = {64, 128, 192, 256, 512};
+  size_t const count = 64;
+  for (size_t bits : sizes) {
+    size_t digits = bits * 30103 / 100000;
+    std::vector<big_integer> v, w(count);
+    for (size_t i = 0; i < count; i++)
+      v.push_back(big_integer(random_decimal(digits)));
+    big_integer m(random_decimal(digits)), acc;
+    auto per_value = [&](double us) { return us * 1000 / count; };
+    double t_copy = per_value(measure([&] { for (size_t i = 0; i < count; i++) w[i] = v[i]; }));
+    double t_sum = per_value(measure([&] {
+      acc = 0;
+      for (size_t i = 0; i < count; i++) acc += v[i];
+    }));
+    double t_mul = per_value(measure([&] { for (size_t i = 0; i < count; i++) w[i] = v[i] * v[count - 1 - i]; }));
+    double t_mod = per_value(measure([&] {
+      for (size_t i = 0; i < count; i++) w[i] = big_integer(v[i] * v[count - 1 - i]) % m;
+    }));
+    double t_fma = per_value(measure([&] {
+      for (size_t i = 0; i < count; i++) w[i] = big_integer(v[i] * v[count - 1 - i]) + m;
+    }));
+    std::printf("%8zu %10.1f %10.1f %10.1f %12.1f %12.1f\n", bits, t_copy, t_sum, t_mul, t_mod, t_fma);
+  }
+}
+
+// Copies of a shared buffer, with plain and atomic reference counts (single thread)
+template<bool Atomic>
+void bench_refcount_mode(char const* name) {
+  size_t const batch = 1000;
+  basic_opt_vector<1, Atomic> shared;
+  shared.resize(64);
+  basic_opt_vector<1, Atomic> const& constant = shared;
+  uint64_t sum = 0;
+  auto batched = [&](double us) { return us * 1000 / batch; };
+  double t_copy = batched(measure([&] {
+    for (size_t i = 0; i < batch; i++) {
+      basic_opt_vector<1, Atomic> copy = constant;
+      sum += copy.size();
+    }
+  }));
+  double t_assign = batched(measure([&] {
+    basic_opt_vector<1, Atomic> copy;
+    for (size_t i = 0; i < batch; i++) {
+      copy = constant;
+      sum += copy.size();
+    }
+  }));
+  double t_detach = batched(measure([&] {
+    for (size_t i = 0; i < batch; i++) {
+      basic_opt_vector<1, Atomic> copy = constant;
+      copy[0] = i;
+      sum += copy[0];
+    }
+  }));
+  std::printf("%8s %12.2f %12.2f %12.2f\n", name, t_copy, t_assign, t_detach + 0 * static_cast<double>(sum));
+}
+
+void bench_refcount() {
+  std::printf("copies of a shared 64-limb buffer (ns per copy)\n");
+  std::printf("%8s %12s %12s %12s\n", "refcount", "copy", "assign", "copy+write");
+  bench_refcount_mode<false>("plain");
+  bench_refcount_mode<true>("atomic");
+}
+
+// Heap allocations per call of f, after one call to warm up the caches
+template<typename F>
+double allocations_per_call(F&& f) {
+  size_t const calls = 100;
+  f();
+  size_t before = allocations.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < calls; i++)
+    f();
+  return static_cast<double>(allocations.load(std::memory_order_relaxed) - before) / calls;
+}
+
+void bench_batch() {
+  std::printf("elementwise columns of 10000 n-bit values, loop of operators against batch calls (ns per element)\n");
+  std::printf("%8s %10s %10s %10s %10s\n", "bits", "a[i]+b[i]", "add_n", "a[i]*b[i]", "mul_n");
+  size_t const sizes[] = {64, 256, 1024, 8192};
+  size_t const count = 10000;
+  for (size_t bits : sizes) {
+    size_t digits = bits * 30103 / 100000;
+    std::vector<big_integer> a, b, out(count);
+    for (size_t i = 0; i < count; i++) {
+      a.push_back(big_integer(random_decimal(digits)));
+      b.push_back(big_integer(random_decimal(digits)));
+    }
+    auto per_element = [&](double us) { return us * 1000 / count; };
+    double t_add = per_element(measure([&] { for (size_t i = 0; i < count; i++) out[i] = a[i] + b[i]; }));
+    double t_add_n = per_element(measure([&] { add_n(out.data(), a.data(), b.data(), count); }));
+    double t_mul = per_element(measure([&] { for (size_t i = 0; i < count; i++) out[i] = a[i] * b[i]; }));
+    double t_mul_n = per_element(measure([&] { mul_n(out.data(), a.data(), b.data(), count); }));
+    std::printf("%8zu %10.1f %10.1f %10.1f %10.1f\n", bits, t_add, t_add_n, t_mul, t_mul_n);
+  }
+}
+
+void bench_trees() {
+  std::printf("n! and the product of n random 64-bit values, left fold against product tree (ms per call)\n");
+  std::printf("%8s %12s %12s %12s %12s\n", "n", "fold n!", "factorial", "fold", "product");
+  size_t const sizes[] = {1000, 10000, 100000};
+  for (size_t n : sizes) {
+    std::vector<big_integer> values;
+    for (size_t i = 0; i < n; i++)
+      values.push_back(big_integer(random_decimal(19)));
+    big_integer res;
+    double t_fold_fact = measure([&] {
+      res = 1;
+      for (uint32_t i = 2; i <= n; i++)
+        res *= big_integer(i);
+    });
+    double t_fact = measure([&] { res = factorial(static_cast<uint32_t>(n)); });
+    double t_fold = measure([&] {
+      res = 1;
+      for (auto const& x : values)
+        res *= x;
+    });
+    double t_tree = measure([&] { res = product(values); });
+    std::printf("%8zu %12.3f %12.3f %12.3f %12.3f\n", n, t_fold_fact / 1000, t_fact / 1000, t_fold / 1000,
+                t_tree / 1000);
+  }
+}
+
+void bench_powmod() {
+  std::printf("modular exponentiation, n-bit base, exponent and modulus (ms per call)\n");
+  std::printf("%8s %14s %14s %14s\n", "bits", "* and %", "powmod odd", "powmod even");
+  size_t const sizes[] = {512, 1024, 2048, 4096, 8192};
+  for (size_t bits : sizes) {
+    size_t digits = bits * 30103 / 100000;
+    big_integer b(random_decimal(digits)), e(random_decimal(digits)), m(random_decimal(digits));
+    big_integer odd = m | 1, even = m - (m & 1), res;
+    double t_naive = measure([&] {
+      big_integer x = b % odd, k = e;
+      res = 1;
+      while (k != 0) {
+        if ((k & 1) != 0)
+          res = res * x % odd;
+        x = x * x % odd;
+        k >>= 1;
+      }
+    });
+    double t_odd = measure([&] { res = powmod(b, e, odd); });
+    double t_even = measure([&] { res = powmod(b, e, even); });
+    std::printf("%8zu %14.3f %14.3f %14.3f\n", bits, t_naive / 1000, t_odd / 1000, t_even / 1000);
+  }
+}
+
+void bench_barrett() {
+  std::printf("products reduced by a fixed n-bit modulus (us per call, heap allocations per call)\n");
+  std::printf("%8s %12s %12s %12s %12s %8s\n", "bits", "a * b % m", "mulmod", "ctx.mulmod", "ctx.addmod",
+              "allocs");
+  size_t const sizes[] = {128, 512, 2048, 8192, 65536, 524288};
+  for (size_t bits : sizes) {
+    size_t digits = bits * 30103 / 100000;
+    big_integer m(random_decimal(digits)), a(random_decimal(digits - 1)), b(random_decimal(digits - 1)), res;
+    barrett_context ctx(m);
+    double t_mod = measure([&] { res = a * b % m; });
+    double t_mulmod = measure([&] { res = mulmod(a, b, m); });
+    double t_ctx = measure([&] { ctx.mulmod(res, a, b); });
+    double t_add = measure([&] { ctx.addmod(res, a, b); });
+    double allocs = allocations_per_call([&] { ctx.mulmod(res, a, b); ctx.addmod(res, res, a); });
+    std::printf("%8zu %12.3f %12.3f %12.3f %12.3f %8.1f\n", bits, t_mod, t_mulmod, t_ctx, t_add, allocs);
+  }
+}
+
+void bench_allocations() {
+  std::printf("heap allocations per call, n-bit operands, division 2n by n bits\n");
+  std::printf("%8s %10s %10s %10s %10s %12s %14s\n", "bits", "a * b", "a / b", "a % b", "a & -b",
+              "to_string", "x *= a, x %= b");
+  size_t const sizes[] = {256, 4096, 65536};
+  for (size_t bits : sizes) {
+    size_t digits = bits * 30103 / 100000;
+    big_integer a(random_decimal(digits)), b(random_decimal(digits)), c(random_decimal(2 * digits));
+    big_integer res, x = c % b;
+    std::string s;
+    double n_mul = allocations_per_call([&] { res = a * b; });
+    double n_div = allocations_per_call([&] { res = c / a; });
+    double n_mod = allocations_per_call([&] { res = c % a; });
+    double n_and = allocations_per_call([&] { res = a & -b; });
+    double n_str = allocations_per_call([&] { s = to_string(c); });
+    double n_mulmod = allocations_per_call([&] { x *= a; x %= b; });
+    std::printf("%8zu %10.1f %10.1f %10.1f %10.1f %12.1f %14.1f\n", bits, n_mul, n_div, n_mod, n_and,
+                n_str, n_mulmod);
+  }
+}
+
+void bench_threads() {
+  std::printf("multiplication on worker threads, n x n limbs (ms per call, speedup over 1 thread)\n");
+  std::printf("%8s", "n");
+  size_t const counts[] = {1, 2, 4, 8, 16};
+  for (size_t t : counts)
+    std::printf(" %9zu thr", t);
+  std::printf("\n");
+  size_t const sizes[] = {8192, 65536, 262144};
+  for (size_t n : sizes) {
+    std::vector<uint64_t> a = random_limbs(n), b = random_limbs(n), res(2 * n);
+    std::printf("%8zu", n);
+    double base = 0;
+    for (size_t t : counts) {
+      limbs::set_threads(t);
+      double us = measure([&] { limbs::mul(res.data(), a.data(), n, b.data(), n); });
+      if (t == 1)
+        base = us;
+      std::printf(" %7.2f/%-5.2f", us / 1000, base / us);
+    }
+    std::printf("\n");
+  }
+  limbs::set_threads(1);
+  std::printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+}
+
+void bench_fused() {
+  std::printf("fused kernels against a full product, n-bit operands (us per call)\n");
+  std::printf("%8s %14s %14s %14s %14s\n", "bits", "acc += (a*b)", "addmul", "(a*b) % m", "mulmod");
+  size_t const sizes[] = {128, 256, 512, 1024, 2048, 8192};
+  for (size_t bits : sizes) {
+    size_t digits = bits * 30103 / 100000;
+    big_integer a(random_decimal(digits)), b(random_decimal(digits)), m(random_decimal(digits));
+    big_integer acc, res;
+    double t_add = measure([&] { acc += big_integer(a * b); });
+    double t_addmul = measure([&] { addmul(acc, a, b); });
+    double t_mod = measure([&] { res = big_integer(a * b) % m; });
+    double t_mulmod = measure([&] { res = mulmod(a, b, m); });
+    std::printf("%8zu %14.3f %14.3f %14.3f %14.3f\n", bits, t_add, t_addmul, t_mod, t_mulmod);
+  }
+}
+}
+
+int main() {
+  bench_big_integer();
+  bench_small();
+  bench_mix();
+  bench_refcount();
+  bench_batch();
+  bench_trees();
+  bench_powmod();
+  bench_barrett();
+  bench_allocations();
+  bench_fused();
+  bench_mul();
+  bench_sqr();
+  bench_mul_huge();
+  bench_threads();
+  bench_div();
+  bench_div_huge();
+  bench_to_decimal();
+  bench_from_decimal();
+  bench_bitwise();
+  return 0;
+}
@@ -2,12 +2,15 @@
 #include <cassert>
 #include <cstdlib>
 #include <random>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 #include <utility>
 #include <gtest/gtest.h>
 
 #include "big_integer.h"
 #include "big_integer_gmp.h"
+#include "limbs.h"
 
 TEST(correctness, two_plus_two) {
   EXPECT_EQ(big_integer(4), big_integer(2) + big_integer(2));
@@ -509,6 +512,37 @@ TEST(correctness, div_long_signed2) {
   EXPECT_EQ(c, a / b);
 }
 
+TEST(correctness, divmod_signed) {
+  int const values[][2] = {{20, 7}, {-20, 7}, {20, -7}, {-20, -7}, {6, 7}, {-6, 7}, {0, -7}};
+  for (auto const& v : values) {
+    std::pair<big_integer, big_integer> qr = divmod(v[0], v[1]);
+    EXPECT_EQ(v[0] / v[1], qr.first);
+    EXPECT_EQ(v[0] % v[1], qr.second);
+  }
+}
+
+TEST(correctness, move_operands) {
+  big_integer a("-123456789012345678901234567890");
+  big_integer b("98765432109876543210987654321");
+
+  EXPECT_EQ(a - b, a - big_integer(b));
+  EXPECT_EQ(b - a, big_integer(b) - big_integer(a));
+  EXPECT_EQ(a + b, a + big_integer(b));
+  EXPECT_EQ(a & b, a & big_integer(b));
+  EXPECT_EQ(a | b, a | big_integer(b));
+  EXPECT_EQ(a ^ b, a ^ big_integer(b));
+
+  // moved-from numbers are zero
+  big_integer c = a;
+  big_integer d = std::move(c);
+  EXPECT_EQ(a, d);
+  EXPECT_EQ(big_integer(0), c);
+  c = std::move(d);
+  EXPECT_EQ(a, c);
+  EXPECT_EQ(big_integer(0), d);
+  EXPECT_EQ(big_integer("-12193263113702179522618503273140070112101524157998904130479"), b * c + b - c);
+}
+
 TEST(correctness, negation_long) {
   big_integer a("10000000000000000000000000000000000000000000000000000");
   big_integer c("-10000000000000000000000000000000000000000000000000000");
@@ -557,6 +591,21 @@ TEST(correctness, string_conv) {
   EXPECT_EQ("-2147483649", to_string(lim));
 }
 
+TEST(correctness, string_conv_invalid) {
+  EXPECT_EQ(123, big_integer("+123"));
+  EXPECT_EQ(-123, big_integer("-123"));
+  EXPECT_EQ("0", to_string(big_integer("-0")));
+  EXPECT_EQ("0", to_string(big_integer("+0")));
+  EXPECT_THROW(big_integer(""), std::invalid_argument);
+  EXPECT_THROW(big_integer("-"), std::invalid_argument);
+  EXPECT_THROW(big_integer("+"), std::invalid_argument);
+  EXPECT_THROW(big_integer("12a3"), std::invalid_argument);
+  EXPECT_THROW(big_integer("abc"), std::invalid_argument);
+  EXPECT_THROW(big_integer("--1"), std::invalid_argument);
+  EXPECT_THROW(big_integer(" 1"), std::invalid_argument);
+  EXPECT_THROW(big_integer(std::string(1000, '7') + "x"), std::invalid_argument);
+}
+
 namespace {
 size_t const number_of_iterations = 10;
 size_t const max_size = 2048;
@@ -724,6 +773,33 @@ TEST(correctness_random, mul) {
   }
 }
 
+TEST(correctness_random, mul_long) {
+  std::default_random_engine rng(42);
+  size_t const sizes[][2] = {{1200, 1300}, {4000, 3000}, {16000, 16000}, {40000, 3000}, {30000, 17000}, {40000, 40000}, {60000, 50000}};
+  for (auto const& sz : sizes) {
+    big_integer_gmp a, b;
+    a.random(sz[0], rng);
+    b.random(sz[1], rng);
+    big_integer_gmp c = a * b;
+    big_integer R = big_integer(to_string(a)) * big_integer(to_string(b));
+    EXPECT_EQ(to_string(c), to_string(R));
+  }
+}
+
+TEST(correctness_random, sqr) {
+  std::default_random_engine rng(42);
+  size_t const sizes[] = {64, 2000, 3000, 12000, 40000, 60000};
+  for (size_t sz : sizes) {
+    big_integer_gmp a;
+    a.random(sz, rng);
+    big_integer_gmp c = a * a;
+    big_integer A = big_integer(to_string(a));
+    big_integer copy = A;
+    EXPECT_EQ(to_string(c), to_string(A * A));
+    EXPECT_EQ(to_string(c), to_string(A * copy));
+  }
+}
+
 TEST(correctness_random, div) {
   std::default_random_engine rng(322);
   for (size_t itn = 0; itn != number_of_iterations; ++itn) {
@@ -740,6 +816,67 @@ TEST(correctness_random, div) {
   }
 }
 
+TEST(correctness_random, div_long) {
+  std::default_random_engine rng(322);
+  size_t const sizes[][2] = {{4000, 2000}, {9000, 3000}, {20000, 1900}, {20000, 10000}, {40000, 20000}, {60000, 25000}};
+  for (auto const& sz : sizes) {
+    big_integer_gmp a, b;
+    a.random(sz[0], rng);
+    b.random(sz[1], rng);
+    big_integer_gmp c = a / b;
+    big_integer R = big_integer(to_string(a)) / big_integer(to_string(b));
+    EXPECT_EQ(to_string(c), to_string(R));
+  }
+}
+
+TEST(correctness_random, div_huge) {
+  // The test binary lowers NEWTON_THRESHOLD (BIG_INTEGER_NEWTON_THRESHOLD in CMakeLists.txt), so
+  // divisors of a few hundred limbs with a quotient three times longer reach the Newton tier
+  std::default_random_engine rng(322);
+  size_t const sizes[][2] = {{120000, 24000}, {200000, 9000}, {100000, 25000}};
+  for (auto const& sz : sizes) {
+    big_integer_gmp a, b;
+    a.random(sz[0], rng);
+    b.random(sz[1], rng);
+    big_integer A(to_string(a)), B(to_string(b));
+    EXPECT_EQ(to_string(a / b), to_string(A / B));
+    EXPECT_EQ(to_string(a % b), to_string(A % B));
+  }
+}
+
+TEST(correctness_random, to_string_long) {
+  std::default_random_engine rng(42);
+  big_integer_gmp a = 1;
+  big_integer A = 1;
+  for (size_t i = 0; i != 40; ++i) {
+    big_integer_gmp p;
+    p.random(30000, rng);
+    a *= p;
+    A *= big_integer(to_string(p));
+    if (i % 8 == 0) {
+      EXPECT_EQ(to_string(a), to_string(A));
+    }
+  }
+  EXPECT_EQ(to_string(a), to_string(A));
+  EXPECT_EQ(to_string(-a), to_string(-A));
+}
+
+TEST(correctness_random, string_conv_long) {
+  std::default_random_engine rng(42);
+  size_t const sizes[] = {3000, 20000, 100000};
+  for (size_t sz : sizes) {
+    big_integer_gmp a;
+    a.random(sz, rng);
+    std::string s = to_string(a);
+    EXPECT_EQ(s, to_string(big_integer(s)));
+    EXPECT_EQ(to_string(a + 1), to_string(big_integer(s) + 1));
+  }
+  std::string zeros(5000, '0');
+  EXPECT_EQ("12345", to_string(big_integer(zeros + "12345")));
+  EXPECT_EQ("-12345", to_string(big_integer("-" + zeros + "12345")));
+  EXPECT_EQ("1" + zeros, to_string(big_integer("1" + zeros)));
+}
+
 TEST(correctness_random, mod) {
   std::default_random_engine rng(322);
   for (size_t itn = 0; itn != number_of_iterations; ++itn) {
@@ -756,6 +893,352 @@ TEST(correctness_random, mod) {
   }
 }
 
+TEST(correctness_random, divmod) {
+  std::default_random_engine rng(322);
+  for (size_t itn = 0; itn != number_of_iterations; ++itn) {
+    big_integer_gmp a, b;
+    a.random(max_size, rng);
+    b.random(max_size / 2, rng);
+    std::pair<big_integer, big_integer> R = divmod(big_integer(to_string(a)), big_integer(to_string(b)));
+    EXPECT_EQ(to_string(a / b), to_string(R.first));
+    EXPECT_EQ(to_string(a % b), to_string(R.second));
+  }
+}
+
+TEST(correctness_random, fused) {
+  std::default_random_engine rng(7);
+  size_t const sizes[] = {100, 1000, 10000};
+  for (size_t sz : sizes) {
+    for (size_t itn = 0; itn != number_of_iterations; ++itn) {
+      big_integer_gmp a, b, c, m;
+      a.random(sz, rng);
+      b.random(sz / 2, rng);
+      c.random(sz, rng);
+      m.random(sz / 3, rng);
+      big_integer A(to_string(a)), B(to_string(b)), C(to_string(c)), M(to_string(m));
+
+      EXPECT_EQ(to_string(a * b + c), to_string(A * B + C));
+      EXPECT_EQ(to_string(c + a * b), to_string(C + A * B));
+      EXPECT_EQ(to_string(c - a * b), to_string(C - A * B));
+      EXPECT_EQ(to_string(a * b % m), to_string(A * B % M));
+      EXPECT_EQ(to_string(a * a % m), to_string(mulmod(A, A, M)));
+
+      big_integer R = C;
+      R += A * B;
+      EXPECT_EQ(to_string(c + a * b), to_string(R));
+      R -= A * B;
+      EXPECT_EQ(to_string(c), to_string(R));
+      submul(R, A, B);
+      EXPECT_EQ(to_string(c - a * b), to_string(R));
+      addmul(R, R, B);
+      EXPECT_EQ(to_string((c - a * b) * (b + 1)), to_string(R));
+    }
+  }
+  // a one-limb modulus, and a product long enough for the Newton tier of the test binary
+  size_t const mulmod_sizes[][2] = {{3000, 60}, {30000, 5000}};
+  for (auto const& sz : mulmod_sizes) {
+    big_integer_gmp a, b, m;
+    a.random(sz[0], rng);
+    b.random(sz[0], rng);
+    m.random(sz[1], rng);
+    big_integer A(to_string(a)), B(to_string(b)), M(to_string(m));
+    EXPECT_EQ(to_string(a * b % m), to_string(mulmod(A, B, M)));
+    EXPECT_EQ(to_string(a * a % m), to_string(mulmod(A, A, M)));
+  }
+}
+
+// Operands around 2^64, where the native fast paths meet the limb kernels
+TEST(correctness_random, small_values) {
+  std::default_random_engine rng(64);
+  for (size_t itn = 0; itn != 1000; ++itn) {
+    big_integer_gmp a, b;
+    a.random(60 + itn % 5, rng);
+    b.random(60 + itn / 5 % 5, rng);
+    big_integer A(to_string(a)), B(to_string(b));
+
+    EXPECT_EQ(to_string(a + b), to_string(A + B));
+    EXPECT_EQ(to_string(a - b), to_string(A - B));
+    EXPECT_EQ(to_string(a * b), to_string(A * B));
+    EXPECT_EQ(a < b, A < B);
+    EXPECT_EQ(a > b, A > B);
+    EXPECT_EQ(a == b, A == B);
+
+    big_integer R = A;
+    R *= B;
+    EXPECT_EQ(to_string(a * b), to_string(R));
+    R = A;
+    R -= B;
+    EXPECT_EQ(to_string(a - b), to_string(R));
+    if (to_string(b) != "0") {
+      EXPECT_EQ(to_string(a / b), to_string(A / B));
+      EXPECT_EQ(to_string(a % b), to_string(A % B));
+      R = A;
+      R /= B;
+      EXPECT_EQ(to_string(a / b), to_string(R));
+      R = A;
+      R %= B;
+      EXPECT_EQ(to_string(a % b), to_string(R));
+    }
+  }
+}
+
+TEST(correctness_random, compound_assignment) {
+  std::default_random_engine rng(11);
+  size_t const sizes[] = {100, 1000, 10000};
+  for (size_t sz : sizes) {
+    for (size_t itn = 0; itn != number_of_iterations; ++itn) {
+      big_integer_gmp a, b, m;
+      a.random(sz, rng);
+      b.random(sz / 2, rng);
+      m.random(sz / 3, rng);
+      big_integer A(to_string(a)), B(to_string(b)), M(to_string(m));
+
+      big_integer R = A;
+      R *= B;
+      EXPECT_EQ(to_string(a * b), to_string(R));
+      R %= M;
+      EXPECT_EQ(to_string(a * b % m), to_string(R));
+      R = A;
+      R /= B;
+      EXPECT_EQ(to_string(a / b), to_string(R));
+      R = B;
+      R /= A;
+      EXPECT_EQ(to_string(b / a), to_string(R));
+      R = B;
+      R %= A;
+      EXPECT_EQ(to_string(b % a), to_string(R));
+      R *= big_integer(-3);
+      EXPECT_EQ(to_string(b % a * -3), to_string(R));
+
+      // aliased and shared operands
+      R = A;
+      R *= R;
+      EXPECT_EQ(to_string(a * a), to_string(R));
+      R = A;
+      big_integer S = A;
+      R *= S;
+      EXPECT_EQ(to_string(a * a), to_string(R));
+      R %= R;
+      EXPECT_EQ("0", to_string(R));
+      R = A;
+      R /= R;
+      EXPECT_EQ("1", to_string(R));
+    }
+  }
+}
+
+TEST(correctness_random, batch) {
+  std::default_random_engine rng(42);
+  // enough elements for several chunks of BATCH_GRAIN, parsed from a few dozen values
+  // so that elements at different indices never share a buffer
+  size_t const count = 600;
+  std::vector<std::string> values;
+  for (size_t i = 0; i < 40; i++) {
+    size_t sizes[] = {30, 64, 127, 500, 3000, 10000};
+    big_integer_gmp x;
+    x.random(sizes[i % 6], rng);
+    values.push_back(to_string(x));
+  }
+  std::vector<big_integer> a, b;
+  for (size_t i = 0; i < count; i++) {
+    std::string const& x = values[rng() % values.size()];
+    a.emplace_back(x);
+    b.emplace_back(i % 7 == 0 ? x : values[rng() % values.size()]);
+  }
+  b[1] = a[1];
+  std::vector<big_integer> out(count);
+  for (size_t threads : {1, 4}) {
+    limbs::set_threads(threads);
+    for (size_t round = 0; round < 2; round++) {
+      add_n(out.data(), a.data(), b.data(), count);
+      for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(a[i] + b[i], out[i]);
+      }
+      sub_n(out.data(), a.data(), b.data(), count);
+      for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(a[i] - b[i], out[i]);
+      }
+      mul_n(out.data(), a.data(), b.data(), count);
+      for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(a[i] * b[i], out[i]);
+      }
+    }
+    std::vector<big_integer> x = a, y = b;
+    sub_n(x.data(), x.data(), b.data(), count);
+    sub_n(y.data(), a.data(), y.data(), count);
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(a[i] - b[i], x[i]);
+      EXPECT_EQ(a[i] - b[i], y[i]);
+    }
+    mul_n(x.data(), a.data(), y.data(), count);
+    mul_n(y.data(), y.data(), y.data(), count);
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(a[i] * (a[i] - b[i]), x[i]);
+      EXPECT_EQ((a[i] - b[i]) * (a[i] - b[i]), y[i]);
+    }
+  }
+  limbs::set_threads(1);
+}
+
+TEST(correctness_random, product_sum) {
+  std::default_random_engine rng(42);
+  for (size_t threads : {1, 4}) {
+    limbs::set_threads(threads);
+    for (size_t count : {0, 1, 2, 3, 10, 37}) {
+      std::vector<big_integer> values;
+      big_integer_gmp p = 1, s = 0;
+      for (size_t i = 0; i < count; i++) {
+        big_integer_gmp x;
+        x.random(i % 10 == 0 ? 20000 : 100, rng);
+        p *= x;
+        s += x;
+        values.emplace_back(to_string(x));
+      }
+      EXPECT_EQ(to_string(p), to_string(product(values)));
+      EXPECT_EQ(to_string(s), to_string(sum(values)));
+      EXPECT_EQ(to_string(p), to_string(product(values.begin(), values.end())));
+    }
+    std::vector<big_integer> same(100, big_integer("123456789012345678901234567890"));
+    EXPECT_EQ(same[0] * same[0], product(same.begin(), same.begin() + 2));
+    EXPECT_EQ(same[0] * 100, sum(same));
+  }
+  limbs::set_threads(1);
+  int const small[] = {3, 5, 7};
+  EXPECT_EQ(105, product(small, small + 3));
+  EXPECT_EQ(15, sum(small, small + 3));
+}
+
+TEST(correctness, factorial_binomial) {
+  big_integer_gmp f = 1;
+  for (uint32_t n = 0; n <= 3000; n++) {
+    if (n > 0) {
+      f *= big_integer_gmp(static_cast<int>(n));
+    }
+    if (n <= 30 || n % 250 == 0) {
+      EXPECT_EQ(to_string(f), to_string(factorial(n)));
+    }
+  }
+  for (uint32_t n = 0; n <= 40; n++) {
+    for (uint32_t k = 0; k <= n + 1; k++) {
+      big_integer expected = (k > n ? big_integer(0) : factorial(n) / (factorial(k) * factorial(n - k)));
+      EXPECT_EQ(expected, binomial(n, k));
+    }
+  }
+  uint32_t const big[][2] = {{1000, 500}, {10000, 17}, {100000, 30000}, {20000, 10}, {20000, 19990}};
+  for (auto const& nk : big) {
+    EXPECT_EQ(factorial(nk[0]) / factorial(nk[1]) / factorial(nk[0] - nk[1]), binomial(nk[0], nk[1]));
+  }
+  EXPECT_EQ(binomial(100000, 30000) + binomial(100000, 30001), binomial(100001, 30001));
+  // a small k never sieves up to n
+  EXPECT_EQ(binomial(100000, 50) * 99950, binomial(100000, 51) * 51);
+  EXPECT_EQ(big_integer("499999999500000000"), binomial(1000000000, 2));
+  EXPECT_EQ(big_integer("4294967295"), binomial(4294967295u, 1));
+  EXPECT_EQ(big_integer("4294967295"), binomial(4294967295u, 4294967294u));
+  EXPECT_EQ(1, binomial(4294967295u, 4294967295u));
+  EXPECT_EQ(0, binomial(4294967294u, 4294967295u));
+}
+
+namespace {
+// base^exp % mod by square-and-multiply through * and %
+big_integer powmod_reference(big_integer base, big_integer exp, big_integer const& mod) {
+  big_integer res = 1 % mod;
+  base %= mod;
+  while (exp != 0) {
+    if ((exp & 1) != 0) {
+      res = res * base % mod;
+    }
+    base = base * base % mod;
+    exp >>= 1;
+  }
+  return res;
+}
+}
+
+TEST(correctness, powmod) {
+  EXPECT_EQ(1, powmod(5, 0, 7));
+  EXPECT_EQ(0, powmod(5, 0, 1));
+  EXPECT_EQ(0, powmod(5, 3, -1));
+  EXPECT_EQ(0, powmod(0, 3, 7));
+  EXPECT_EQ(0, powmod(14, 3, 7));
+  EXPECT_EQ(6, powmod(5, 3, 7));
+  EXPECT_EQ(-6, powmod(-5, 3, 7));
+  EXPECT_EQ(4, powmod(-5, 2, -7));
+  EXPECT_EQ(big_integer("340282366920938463463374607431768211456") % big_integer("1000000007"),
+            powmod(2, 128, 1000000007));
+  EXPECT_EQ(0, powmod(2, 200, big_integer(1) << 130));
+  EXPECT_THROW(powmod(2, -1, 7), std::domain_error);
+  EXPECT_THROW(powmod(2, 3, 0), std::domain_error);
+  EXPECT_THROW(powmod(2, 0, 0), std::domain_error);
+  EXPECT_THROW(barrett_context{0}, std::domain_error);
+}
+
+TEST(correctness_random, powmod) {
+  std::default_random_engine rng(42);
+  size_t const sizes[][3] = {{64, 64, 64}, {100, 300, 127}, {3000, 1000, 1024}, {700, 2048, 2048},
+                             {2000, 100, 4096}, {5000, 64, 3000}};
+  for (auto const& sz : sizes) {
+    for (size_t itn = 0; itn < 6; itn++) {
+      big_integer_gmp b, e, m;
+      b.random(sz[0], rng);
+      e.random(sz[1], rng);
+      m.random(sz[2], rng);
+      big_integer base(to_string(b)), exp(to_string(e)), mod(to_string(m));
+      if (exp < 0) {
+        exp = -exp;
+      }
+      if (mod == 0) {
+        continue;
+      }
+      if (itn % 2 == 0) {
+        mod |= 1;
+      }
+      EXPECT_EQ(powmod_reference(base, exp, mod), powmod(base, exp, mod));
+    }
+  }
+}
+
+TEST(correctness_random, barrett_context) {
+  std::default_random_engine rng(42);
+  // the test binary lowers BARRETT_THRESHOLD to 16 limbs, 1024 bits
+  size_t const sizes[] = {1, 63, 64, 65, 200, 900, 1100, 3000, 10000};
+  for (size_t sz : sizes) {
+    for (size_t itn = 0; itn < 4; itn++) {
+      big_integer_gmp gm;
+      gm.random(sz, rng);
+      big_integer m(to_string(gm));
+      if (m == 0) {
+        continue;
+      }
+      barrett_context ctx(m);
+      EXPECT_EQ(m, ctx.modulus());
+      for (size_t k = 0; k < 5; k++) {
+        big_integer_gmp ga, gb;
+        ga.random(sz * (k + 1) / 2, rng);
+        gb.random(sz, rng);
+        big_integer a(to_string(ga)), b(to_string(gb));
+        EXPECT_EQ(a % m, ctx.reduce(a));
+        EXPECT_EQ(a * b % m, ctx.mulmod(a, b));
+        EXPECT_EQ(a * a % m, ctx.mulmod(a, a));
+        big_integer x = ctx.reduce(a), y = ctx.reduce(b);
+        EXPECT_EQ((x + y) % m, ctx.addmod(x, y));
+        EXPECT_EQ((x - y) % m, ctx.submod(x, y));
+        EXPECT_EQ((a + b) % m, ctx.addmod(a, b));
+        EXPECT_EQ((a - b) % m, ctx.submod(a, b));
+        // in place, into the buffer of an operand
+        big_integer r = a;
+        ctx.mulmod(r, r, b);
+        EXPECT_EQ(a * b % m, r);
+        ctx.addmod(r, r, r);
+        EXPECT_EQ((a * b % m) * 2 % m, r);
+        ctx.submod(r, b, r);
+        EXPECT_EQ((b - (a * b % m) * 2 % m) % m, r);
+        ctx.reduce(r, r);
+        EXPECT_EQ((b - (a * b % m) * 2 % m) % m, r);
+      }
+    }
+  }
+}
+
 TEST(correctness_random, bitwise) {
   std::default_random_engine rng(42);
   for (size_t itn = 0; itn != number_of_iterations; ++itn) {
@@ -789,6 +1272,30 @@ TEST(correctness_random, bit_shifts) {
   }
 }
 
+TEST(correctness_random, bit_shifts_edges) {
+  std::default_random_engine rng(42);
+  int const shifts[] = {0, 1, 31, 32, 33, 64, 95, 1000, 3000};
+  for (size_t itn = 0; itn != 20; ++itn) {
+    big_integer_gmp a;
+    a.random(2000, rng);
+    big_integer R = big_integer(to_string(a));
+    for (int shift : shifts) {
+      big_integer copy = R;
+      copy <<= shift;
+      EXPECT_EQ(to_string(a << shift), to_string(copy));
+      copy = R;
+      copy >>= shift;
+      EXPECT_EQ(to_string(a >> shift), to_string(copy));
+      EXPECT_EQ(to_string(a), to_string(R));
+    }
+  }
+  EXPECT_EQ(-1, big_integer(-1) >> 1000);
+  EXPECT_EQ(0, big_integer(1) >> 1000);
+  EXPECT_EQ(-2, big_integer(-3) >> 1);
+  EXPECT_EQ(-1, big_integer(-1) >> 0);
+  EXPECT_EQ(big_integer("-4294967296"), big_integer(-1) << 32);
+}
+
 // TODO: extend due to idea
 TEST(correctness_twos_complement, simple) {
   std::string a = "-36893488147419103232"; // -(1 << 65)
@@ -815,3 +1322,97 @@ TEST(correctness_twos_complement, all_ones) {
 
   EXPECT_EQ(to_string(gmp_ans), to_string(your_ans));
 }
+
+// Copies of one shared vector are made, written to (which detaches them) and destroyed
+// by several threads at once; the shared buffer must stay intact and be freed exactly once
+TEST(thread_safety, atomic_refcount) {
+  size_t const n = 1000;
+  basic_opt_vector<1, true> shared;
+  shared.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    shared[i] = i;
+  }
+  basic_opt_vector<1, true> const& constant = shared;
+  std::vector<std::thread> threads;
+  std::vector<int> failures(4, 0);
+  for (size_t t = 0; t < failures.size(); t++) {
+    threads.emplace_back([&constant, &failures, t, n] {
+      for (size_t itn = 0; itn < 2000; itn++) {
+        basic_opt_vector<1, true> copy = constant;
+        basic_opt_vector<1, true> second = copy;
+        if (itn % 2 == 0) {
+          copy[0] = t + 1;
+        }
+        failures[t] += (second[n - 1] != n - 1) + (constant[0] != 0) + (itn % 2 == 0 && copy[0] != t + 1);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int f : failures) {
+    EXPECT_EQ(0, f);
+  }
+  EXPECT_EQ(0u, constant[0]);
+}
+
+// Toom-Cook and NTT products (and squares) split over worker threads, nested parallel_for included.
+// The test binary lowers PARALLEL_THRESHOLD, only the NTT case needs a large operand.
+TEST(thread_safety, parallel_mul) {
+  std::default_random_engine rng(42);
+  size_t const sizes[][2] = {{40000, 40000}, {150000, 150000}, {300000, 70000}, {800000, 0}};
+  limbs::set_threads(4);
+  for (auto const& sz : sizes) {
+    big_integer_gmp a, b;
+    a.random(sz[0], rng);
+    if (sz[1] == 0) {
+      b = a;
+    } else {
+      b.random(sz[1], rng);
+    }
+    big_integer_gmp c = a * b;
+    big_integer A = big_integer(to_string(a));
+    big_integer R = (sz[1] == 0 ? A * A : A * big_integer(to_string(b)));
+    EXPECT_EQ(to_string(c), to_string(R));
+  }
+  limbs::set_threads(1);
+}
+
+TEST(thread_safety, parallel_for_edges) {
+  limbs::set_threads(4);
+  size_t calls = 0;
+  limbs::parallel_for(0, [&](size_t) { calls++; });
+  EXPECT_EQ(0u, calls);
+  limbs::parallel_for(1, [&](size_t i) { calls += i + 1; });
+  EXPECT_EQ(1u, calls);
+  std::vector<int> hits(100, 0);
+  limbs::parallel_for(hits.size(), [&](size_t i) { hits[i]++; });
+  EXPECT_EQ(std::vector<int>(100, 1), hits);
+  limbs::set_threads(1);
+}
+
+#ifdef BIG_INTEGER_ATOMIC_REFCOUNT
+TEST(thread_safety, shared_constants) {
+  big_integer const c("123456789012345678901234567890123456789012345678901234567890");
+  big_integer const m("98765432109876543210987654321");
+  big_integer const expected = (c * c + c) % m;
+  std::vector<std::thread> threads;
+  std::vector<int> failures(4, 0);
+  for (size_t t = 0; t < failures.size(); t++) {
+    threads.emplace_back([&, t] {
+      for (size_t itn = 0; itn < 2000; itn++) {
+        big_integer x = c;
+        big_integer y = x;
+        y += 1;
+        failures[t] += ((x * c + c) % m != expected) + (y - x != 1);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int f : failures) {
+    EXPECT_EQ(0, f);
+  }
+}
+#endif
@@ -0,0 +1,550 @@
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "limbs.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LIMBS_AVX2 1
+#endif
+
+namespace limbs {
+    size_t normalized(uint64_t const* a, size_t n) {
+        while (n > 0 && a[n - 1] == 0) {
+            n--;
+        }
+        return n;
+    }
+
+    uint64_t add_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n) {
+        uint128_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            c += static_cast<uint128_t>(a[i]) + b[i];
+            res[i] = static_cast<uint64_t>(c);
+            c >>= 64;
+        }
+        return static_cast<uint64_t>(c);
+    }
+
+    uint64_t sub_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n) {
+        uint64_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint128_t d = static_cast<uint128_t>(a[i]) - b[i] - c;
+            res[i] = static_cast<uint64_t>(d);
+            c = static_cast<uint64_t>(d >> 127);
+        }
+        return c;
+    }
+
+    uint64_t add(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        assert(n >= m);
+        uint64_t c = add_n(res, a, b, m);
+        for (size_t i = m; i < n; i++) {
+            res[i] = a[i] + c;
+            c = (c && res[i] == 0);
+        }
+        return c;
+    }
+
+    uint64_t sub(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        assert(n >= m);
+        uint64_t c = sub_n(res, a, b, m);
+        for (size_t i = m; i < n; i++) {
+            uint64_t x = a[i];
+            res[i] = x - c;
+            c = (c && x == 0);
+        }
+        return c;
+    }
+
+    uint64_t neg(uint64_t* res, uint64_t const* a, size_t n) {
+        size_t i = 0;
+        for (; i < n && a[i] == 0; i++) {
+            res[i] = 0;
+        }
+        if (i == n) {
+            return 0;
+        }
+        res[i] = -a[i];
+        for (i++; i < n; i++) {
+            res[i] = ~a[i];
+        }
+        return 1;
+    }
+
+    int cmp(uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        n = normalized(a, n);
+        m = normalized(b, m);
+        if (n != m) {
+            return n < m ? -1 : 1;
+        }
+        for (size_t i = n; i > 0; i--) {
+            if (a[i - 1] != b[i - 1]) {
+                return a[i - 1] < b[i - 1] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    uint64_t mul_1(uint64_t* res, uint64_t const* a, size_t n, uint64_t k) {
+        uint128_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            c += static_cast<uint128_t>(a[i]) * k;
+            res[i] = static_cast<uint64_t>(c);
+            c >>= 64;
+        }
+        return static_cast<uint64_t>(c);
+    }
+
+    uint64_t addmul_1(uint64_t* res, uint64_t const* a, size_t n, uint64_t k) {
+        uint128_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            c += static_cast<uint128_t>(a[i]) * k + res[i];
+            res[i] = static_cast<uint64_t>(c);
+            c >>= 64;
+        }
+        return static_cast<uint64_t>(c);
+    }
+
+    uint64_t div_1(uint64_t* res, uint64_t const* a, size_t n, uint64_t k) {
+        uint64_t r = 0;
+        for (size_t i = n; i > 0; i--) {
+            res[i - 1] = div_2_1(r, a[i - 1], k, r);
+        }
+        return r;
+    }
+
+    namespace {
+        // The scalar operator for tails and short arrays, and the AVX2 one for 4 limbs at a time
+        struct and_op {
+            uint64_t operator()(uint64_t x, uint64_t y) const {
+                return x & y;
+            }
+#ifdef LIMBS_AVX2
+            __attribute__((target("avx2"))) __m256i operator()(__m256i x, __m256i y) const {
+                return _mm256_and_si256(x, y);
+            }
+#endif
+        };
+
+        struct or_op {
+            uint64_t operator()(uint64_t x, uint64_t y) const {
+                return x | y;
+            }
+#ifdef LIMBS_AVX2
+            __attribute__((target("avx2"))) __m256i operator()(__m256i x, __m256i y) const {
+                return _mm256_or_si256(x, y);
+            }
+#endif
+        };
+
+        struct xor_op {
+            uint64_t operator()(uint64_t x, uint64_t y) const {
+                return x ^ y;
+            }
+#ifdef LIMBS_AVX2
+            __attribute__((target("avx2"))) __m256i operator()(__m256i x, __m256i y) const {
+                return _mm256_xor_si256(x, y);
+            }
+#endif
+        };
+
+        // Below this length the AVX2 loop does not pay for the dispatch
+        size_t const BITWISE_AVX2_THRESHOLD = 16;
+
+#ifdef LIMBS_AVX2
+        bool const has_avx2 = __builtin_cpu_supports("avx2");
+
+        template<typename Op>
+        __attribute__((target("avx2")))
+        void bitwise_n_avx2(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n, Op op) {
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + i));
+                __m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(res + i), op(x, y));
+            }
+            for (; i < n; i++) {
+                res[i] = op(a[i], b[i]);
+            }
+        }
+#endif
+
+        template<typename Op>
+        void bitwise_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n, Op op) {
+#ifdef LIMBS_AVX2
+            if (n >= BITWISE_AVX2_THRESHOLD && has_avx2) {
+                bitwise_n_avx2(res, a, b, n, op);
+                return;
+            }
+#endif
+            for (size_t i = 0; i < n; i++) {
+                res[i] = op(a[i], b[i]);
+            }
+        }
+    }
+
+    void and_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n) {
+        bitwise_n(res, a, b, n, and_op());
+    }
+
+    void or_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n) {
+        bitwise_n(res, a, b, n, or_op());
+    }
+
+    void xor_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n) {
+        bitwise_n(res, a, b, n, xor_op());
+    }
+
+    uint64_t lshift(uint64_t* res, uint64_t const* a, size_t n, unsigned s) {
+        if (n == 0) {
+            return 0;
+        }
+        if (s == 0) {
+            std::copy_backward(a, a + n, res + n);
+            return 0;
+        }
+        uint64_t out = a[n - 1] >> (64 - s);
+        for (size_t i = n - 1; i > 0; i--) {
+            res[i] = (a[i] << s) | (a[i - 1] >> (64 - s));
+        }
+        res[0] = a[0] << s;
+        return out;
+    }
+
+    uint64_t rshift(uint64_t* res, uint64_t const* a, size_t n, unsigned s) {
+        if (n == 0) {
+            return 0;
+        }
+        if (s == 0) {
+            std::copy_n(a, n, res);
+            return 0;
+        }
+        uint64_t out = a[0] << (64 - s);
+        for (size_t i = 0; i + 1 < n; i++) {
+            res[i] = (a[i] >> s) | (a[i + 1] << (64 - s));
+        }
+        res[n - 1] = a[n - 1] >> s;
+        return out;
+    }
+
+    void mul_basecase(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        std::fill_n(res, n + m, 0);
+        for (size_t i = 0; i < n; i++) {
+            uint128_t x = a[i];
+            uint128_t c = 0;
+            for (size_t j = 0; j < m; j++) {
+                c += x * b[j] + res[i + j];
+                res[i + j] = static_cast<uint64_t>(c);
+                c >>= 64;
+            }
+            res[i + m] = static_cast<uint64_t>(c);
+        }
+    }
+
+    void sqr_basecase(uint64_t* res, uint64_t const* a, size_t n) {
+        std::fill_n(res, 2 * n, 0);
+        // products a[i] * a[j] for i < j
+        for (size_t i = 0; i < n; i++) {
+            uint128_t x = a[i];
+            uint128_t c = 0;
+            for (size_t j = i + 1; j < n; j++) {
+                c += x * a[j] + res[i + j];
+                res[i + j] = static_cast<uint64_t>(c);
+                c >>= 64;
+            }
+            res[i + n] = static_cast<uint64_t>(c);
+        }
+        // doubled, plus the squares a[i]^2 on the diagonal
+        uint64_t top = 0;
+        for (size_t i = 0; i < 2 * n; i++) {
+            uint64_t x = res[i];
+            res[i] = (x << 1) | top;
+            top = x >> 63;
+        }
+        uint128_t c = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint128_t sq = static_cast<uint128_t>(a[i]) * a[i];
+            c += static_cast<uint128_t>(res[2 * i]) + static_cast<uint64_t>(sq);
+            res[2 * i] = static_cast<uint64_t>(c);
+            c >>= 64;
+            c += static_cast<uint128_t>(res[2 * i + 1]) + (sq >> 64);
+            res[2 * i + 1] = static_cast<uint64_t>(c);
+            c >>= 64;
+        }
+    }
+
+    namespace {
+        // a = a1 * B^h + a0, b = b1 * B^h + b0 (n >= m > h)
+        // a * b = a1 * b1 * B^2h + ((a0 + a1) * (b0 + b1) - a0 * b0 - a1 * b1) * B^h + a0 * b0
+        // When a and b are the same array all three products are squares.
+        void karatsuba(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+            size_t h = (n + 1) / 2;
+            assert(m > h);
+            mul(res, a, h, b, h);
+            mul(res + 2 * h, a + h, n - h, b + h, m - h);
+
+            bool square = (a == b && n == m);
+            arena_frame frame;
+            uint64_t* sa = frame.alloc(h + 1);
+            uint64_t* sb = (square ? sa : frame.alloc(h + 1));
+            sa[h] = add(sa, a, h, a + h, n - h);
+            if (!square) {
+                sb[h] = add(sb, b, h, b + h, m - h);
+            }
+            size_t na = normalized(sa, h + 1);
+            size_t nb = normalized(sb, h + 1);
+
+            size_t len = na + nb;
+            uint64_t* mid = frame.alloc(len);
+            mul(mid, sa, na, sb, nb);
+            sub(mid, mid, len, res, normalized(res, 2 * h));
+            sub(mid, mid, len, res + 2 * h, normalized(res + 2 * h, n + m - 2 * h));
+            len = normalized(mid, len);
+            assert(len <= n + m - h);
+            add(res + h, res + h, n + m - h, mid, len);
+        }
+
+        // Signed number over a normalized magnitude, used for Toom-Cook evaluation and interpolation
+        struct signed_limbs {
+            std::vector<uint64_t> d;
+            bool neg;
+
+            signed_limbs(): neg(false) {}
+
+            signed_limbs(uint64_t const* a, size_t n): d(a, a + normalized(a, n)), neg(false) {}
+
+            void trim() {
+                d.resize(normalized(d.data(), d.size()));
+                if (d.empty()) {
+                    neg = false;
+                }
+            }
+        };
+
+        // a + b if !negate_b, a - b otherwise
+        signed_limbs add_signed(signed_limbs const& a, signed_limbs const& b, bool negate_b) {
+            bool b_neg = b.neg ^ negate_b;
+            signed_limbs res;
+            if (a.neg == b_neg) {
+                signed_limbs const& x = (a.d.size() >= b.d.size() ? a : b);
+                signed_limbs const& y = (a.d.size() >= b.d.size() ? b : a);
+                res.d.resize(x.d.size() + 1);
+                res.d.back() = add(res.d.data(), x.d.data(), x.d.size(), y.d.data(), y.d.size());
+                res.neg = a.neg;
+            } else {
+                bool a_less = cmp(a.d.data(), a.d.size(), b.d.data(), b.d.size()) < 0;
+                signed_limbs const& x = (a_less ? b : a);
+                signed_limbs const& y = (a_less ? a : b);
+                res.d.resize(x.d.size());
+                sub(res.d.data(), x.d.data(), x.d.size(), y.d.data(), y.d.size());
+                res.neg = (a_less ? b_neg : a.neg);
+            }
+            res.trim();
+            return res;
+        }
+
+        signed_limbs operator+(signed_limbs const& a, signed_limbs const& b) {
+            return add_signed(a, b, false);
+        }
+
+        signed_limbs operator-(signed_limbs const& a, signed_limbs const& b) {
+            return add_signed(a, b, true);
+        }
+
+        signed_limbs operator*(signed_limbs const& a, signed_limbs const& b) {
+            signed_limbs res;
+            res.d.resize(a.d.size() + b.d.size());
+            mul(res.d.data(), a.d.data(), a.d.size(), b.d.data(), b.d.size());
+            res.neg = a.neg ^ b.neg;
+            res.trim();
+            return res;
+        }
+
+        signed_limbs mul_small(signed_limbs a, uint64_t k) {
+            a.d.push_back(mul_1(a.d.data(), a.d.data(), a.d.size(), k));
+            a.trim();
+            return a;
+        }
+
+        signed_limbs div_exact(signed_limbs a, uint64_t k) {
+            uint64_t r = div_1(a.d.data(), a.d.data(), a.d.size(), k);
+            assert(r == 0);
+            (void) r;
+            a.trim();
+            return a;
+        }
+
+        // Slice [i * k, (i + 1) * k) of a clamped to n limbs
+        signed_limbs piece(uint64_t const* a, size_t n, size_t i, size_t k) {
+            size_t from = std::min(n, i * k);
+            size_t to = std::min(n, (i + 1) * k);
+            return signed_limbs(a + from, to - from);
+        }
+
+        // res[0..n) += r * B^shift, r is a non-negative coefficient of the product
+        void add_coefficient(uint64_t* res, size_t n, signed_limbs const& r, size_t shift) {
+            assert(!r.neg);
+            assert(shift + r.d.size() <= n || r.d.empty());
+            if (!r.d.empty()) {
+                add(res + shift, res + shift, n - shift, r.d.data(), r.d.size());
+            }
+        }
+
+        // f(0), ..., f(count - 1) for the independent pointwise products of Toom-Cook,
+        // on the worker threads once the shorter operand has m >= PARALLEL_THRESHOLD limbs
+        template<typename F>
+        void pointwise_products(size_t count, size_t m, F const& f) {
+            if (m >= PARALLEL_THRESHOLD && threads() > 1) {
+                parallel_for(count, f);
+                return;
+            }
+            for (size_t i = 0; i < count; i++) {
+                f(i);
+            }
+        }
+
+        // Evaluates a = sum(p[i] x^i), i < 3, at 0, 1, -1, 2, inf
+        void toom3_evaluate(uint64_t const* a, size_t n, size_t k, signed_limbs (&v)[5]) {
+            signed_limbs p0 = piece(a, n, 0, k), p1 = piece(a, n, 1, k), p2 = piece(a, n, 2, k);
+            signed_limbs even = p0 + p2;
+            v[0] = p0;
+            v[1] = even + p1;
+            v[2] = even - p1;
+            v[3] = p0 + mul_small(p1 + mul_small(p2, 2), 2);
+            v[4] = p2;
+        }
+
+        // Toom-3: a and b are split into three k-limb pieces, the product polynomial of degree 4
+        // is evaluated at 0, 1, -1, 2, inf and interpolated with exact divisions by 2 and 3
+        void toom3(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+            size_t k = (n + 2) / 3;
+            bool square = (a == b && n == m);
+            signed_limbs va[5], vb[5], v[5];
+            toom3_evaluate(a, n, k, va);
+            if (!square) {
+                toom3_evaluate(b, m, k, vb);
+            }
+            // for a square the pointwise products are squares of the same array and go to sqr
+            pointwise_products(5, m, [&](size_t i) {
+                v[i] = va[i] * (square ? va[i] : vb[i]);
+            });
+            signed_limbs r0 = v[0], r4 = v[4];
+            signed_limbs r2 = div_exact(v[1] + v[2], 2) - r0 - r4;
+            signed_limbs odd = div_exact(v[1] - v[2], 2);
+            signed_limbs r3 = div_exact(div_exact(v[3] - r0 - mul_small(r2, 4) - mul_small(r4, 16), 2) - odd, 3);
+            signed_limbs r1 = odd - r3;
+
+            std::fill_n(res, n + m, 0);
+            signed_limbs const* r[] = {&r0, &r1, &r2, &r3, &r4};
+            for (size_t i = 0; i < 5; i++) {
+                add_coefficient(res, n + m, *r[i], i * k);
+            }
+        }
+
+        // Evaluates a = sum(p[i] x^i), i < 4, at 0, 1, -1, 2, -2, 1/2 (scaled by 8), inf
+        void toom4_evaluate(uint64_t const* a, size_t n, size_t k, signed_limbs (&v)[7]) {
+            signed_limbs p0 = piece(a, n, 0, k), p1 = piece(a, n, 1, k);
+            signed_limbs p2 = piece(a, n, 2, k), p3 = piece(a, n, 3, k);
+            signed_limbs even1 = p0 + p2, odd1 = p1 + p3;
+            signed_limbs even2 = p0 + mul_small(p2, 4), odd2 = mul_small(p1 + mul_small(p3, 4), 2);
+            v[0] = p0;
+            v[1] = even1 + odd1;
+            v[2] = even1 - odd1;
+            v[3] = even2 + odd2;
+            v[4] = even2 - odd2;
+            v[5] = p3 + mul_small(p2 + mul_small(p1 + mul_small(p0, 2), 2), 2);
+            v[6] = p3;
+        }
+
+        // Toom-4: four k-limb pieces, the product polynomial of degree 6 is evaluated at
+        // 0, 1, -1, 2, -2, 1/2, inf. Even coefficients are recovered from the +-x pairs,
+        // odd ones from the 3x3 system on r1, r3, r5 with exact divisions by 2, 3, 4, 5.
+        void toom4(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+            size_t k = (n + 3) / 4;
+            bool square = (a == b && n == m);
+            signed_limbs va[7], vb[7], v[7];
+            toom4_evaluate(a, n, k, va);
+            if (!square) {
+                toom4_evaluate(b, m, k, vb);
+            }
+            pointwise_products(7, m, [&](size_t i) {
+                v[i] = va[i] * (square ? va[i] : vb[i]);
+            });
+            signed_limbs r0 = v[0], r6 = v[6];
+            // r2 + r4 and r2 + 4 * r4
+            signed_limbs s1 = div_exact(v[1] + v[2], 2) - r0 - r6;
+            signed_limbs s2 = div_exact(div_exact(v[3] + v[4], 2) - r0 - mul_small(r6, 64), 4);
+            signed_limbs r4 = div_exact(s2 - s1, 3);
+            signed_limbs r2 = s1 - r4;
+            // r1 + r3 + r5, r1 + 4 * r3 + 16 * r5, 16 * r1 + 4 * r3 + r5
+            signed_limbs o1 = div_exact(v[1] - v[2], 2);
+            signed_limbs o2 = div_exact(v[3] - v[4], 4);
+            signed_limbs h = div_exact(v[5] - mul_small(r0, 64) - mul_small(r2, 16) - mul_small(r4, 4) - r6, 2);
+            // r3 + 5 * r5 and 5 * r1 + r3
+            signed_limbs t1 = div_exact(o2 - o1, 3);
+            signed_limbs t2 = div_exact(h - o1, 3);
+            signed_limbs d = div_exact(t2 - t1, 5);
+            signed_limbs r5 = div_exact(d + t1 - o1, 3);
+            signed_limbs r1 = d + r5;
+            signed_limbs r3 = t1 - mul_small(r5, 5);
+
+            std::fill_n(res, n + m, 0);
+            signed_limbs const* r[] = {&r0, &r1, &r2, &r3, &r4, &r5, &r6};
+            for (size_t i = 0; i < 7; i++) {
+                add_coefficient(res, n + m, *r[i], i * k);
+            }
+        }
+
+        // n > 2 * m: multiply b by consecutive m-limb slices of a
+        void mul_unbalanced(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+            mul(res, a, m, b, m);
+            arena_frame frame;
+            uint64_t* tmp = frame.alloc(2 * m);
+            for (size_t i = m; i < n; i += m) {
+                size_t k = std::min(m, n - i);
+                std::fill_n(res + i + m, k, 0);
+                mul(tmp, a + i, k, b, m);
+                add(res + i, res + i, m + k, tmp, m + k);
+            }
+        }
+    }
+
+    void sqr(uint64_t* res, uint64_t const* a, size_t n) {
+        if (n < SQR_KARATSUBA_THRESHOLD) {
+            sqr_basecase(res, a, n);
+        } else if (n < TOOM3_THRESHOLD) {
+            karatsuba(res, a, n, a, n);
+        } else if (n < TOOM4_THRESHOLD) {
+            toom3(res, a, n, a, n);
+        } else if (n < NTT_THRESHOLD) {
+            toom4(res, a, n, a, n);
+        } else {
+            mul_ntt(res, a, n, a, n);
+        }
+    }
+
+    void mul(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        if (a == b && n == m) {
+            sqr(res, a, n);
+            return;
+        }
+        if (n < m) {
+            std::swap(a, b);
+            std::swap(n, m);
+        }
+        if (m < KARATSUBA_THRESHOLD) {
+            mul_basecase(res, a, n, b, m);
+        } else if (m <= (n + 1) / 2) {
+            mul_unbalanced(res, a, n, b, m);
+        } else if (m < TOOM3_THRESHOLD) {
+            karatsuba(res, a, n, b, m);
+        } else if (m < TOOM4_THRESHOLD) {
+            toom3(res, a, n, b, m);
+        } else if (m < NTT_THRESHOLD) {
+            toom4(res, a, n, b, m);
+        } else {
+            mul_ntt(res, a, n, b, m);
+        }
+    }
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Kernels over raw little-endian magnitudes (arrays of uint64_t limbs).
+// They know nothing about signs or opt_vector, big_integer converts its
+// operands to magnitudes once and calls into here.
+namespace limbs {
+    // Double limb for products and carries
+    __extension__ typedef unsigned __int128 uint128_t;
+
+    // (hi * B + lo) / d with the remainder in r, hi < d. A single divq on x86-64 instead of
+    // the generic 128-bit division call.
+    inline uint64_t div_2_1(uint64_t hi, uint64_t lo, uint64_t d, uint64_t& r) {
+#if defined(__GNUC__) && defined(__x86_64__)
+        uint64_t q;
+        __asm__("divq %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+        return q;
+#else
+        uint128_t x = (static_cast<uint128_t>(hi) << 64) | lo;
+        r = static_cast<uint64_t>(x % d);
+        return static_cast<uint64_t>(x / d);
+#endif
+    }
+
+    // Below this size (in limbs of the shorter operand) schoolbook multiplication is used
+    constexpr size_t KARATSUBA_THRESHOLD = 32;
+    // The same for squaring, where the basecase does half of the limb products
+    constexpr size_t SQR_KARATSUBA_THRESHOLD = 48;
+    // Toom-3 and Toom-4 take over from Karatsuba at these sizes
+    constexpr size_t TOOM3_THRESHOLD = 500;
+    constexpr size_t TOOM4_THRESHOLD = 900;
+    // From this size on the product is computed by NTT
+    constexpr size_t NTT_THRESHOLD = 12000;
+    // Below this divisor size (in limbs) schoolbook division is used, above it Burnikel-Ziegler
+    constexpr size_t BZ_THRESHOLD = 40;
+    // From this divisor size on, when the quotient is at least three times longer than the divisor,
+    // division goes through a Newton reciprocal shared by all quotient blocks. The tests lower it
+    // with BIG_INTEGER_NEWTON_THRESHOLD to reach the tier with small operands.
+#ifndef BIG_INTEGER_NEWTON_THRESHOLD
+#define BIG_INTEGER_NEWTON_THRESHOLD 32768
+#endif
+    constexpr size_t NEWTON_THRESHOLD = BIG_INTEGER_NEWTON_THRESHOLD;
+    // From this modulus size on a barrett_context reduces by Barrett steps with its stored
+    // reciprocal, below it by division with its stored normalized modulus. The tests lower it
+    // with BIG_INTEGER_BARRETT_THRESHOLD to reach the Barrett steps with small moduli.
+#ifndef BIG_INTEGER_BARRETT_THRESHOLD
+#define BIG_INTEGER_BARRETT_THRESHOLD 4096
+#endif
+    constexpr size_t BARRETT_THRESHOLD = BIG_INTEGER_BARRETT_THRESHOLD;
+    // From this size (in limbs of the shorter operand) on the independent sub-products of
+    // Toom-Cook and the stages of the NTT are spread over the worker threads, if there are any.
+    // The tests lower it with BIG_INTEGER_PARALLEL_THRESHOLD to reach the threads cheaply.
+#ifndef BIG_INTEGER_PARALLEL_THRESHOLD
+#define BIG_INTEGER_PARALLEL_THRESHOLD 4096
+#endif
+    constexpr size_t PARALLEL_THRESHOLD = BIG_INTEGER_PARALLEL_THRESHOLD;
+    // Below this size (in limbs) decimal conversion peels 19 digits at a time,
+    // above it the number is split by a power of ten
+    constexpr size_t TO_DECIMAL_THRESHOLD = 32;
+    // The same for parsing, in limbs of the result
+    constexpr size_t FROM_DECIMAL_THRESHOLD = 32;
+
+    // Scope on the per-thread bump arena for temporaries of the kernels (limbs_arena.cpp).
+    // Everything taken through a frame is given back when the frame ends, so frames must
+    // nest like the calls that open them. The memory itself is kept: when the outermost frame
+    // ends the arena is merged into one block large enough for the whole operation, and the
+    // next operation of the same size runs without touching the heap. The block is capped at
+    // 8 MiB per thread, larger operations give the rest back to the heap.
+    class arena_frame {
+    public:
+        arena_frame();
+        ~arena_frame();
+        arena_frame(arena_frame const&) = delete;
+        arena_frame& operator=(arena_frame const&) = delete;
+
+        // n uninitialized limbs, valid until the frame ends
+        uint64_t* alloc(size_t n);
+
+    private:
+        size_t block;
+        size_t used;
+    };
+
+    // Number of threads, the calling one included, for the large multiplication tiers
+    // (limbs_pool.cpp). 1 by default, which keeps everything on the calling thread.
+    // Must not be changed while a multiplication is running.
+    void set_threads(size_t n);
+    size_t threads();
+
+    // Calls f(0), ..., f(n - 1) spread over the worker threads and returns when all are done.
+    // Calls may nest: a task can run parallel_for itself.
+    void parallel_for(size_t n, std::function<void(size_t)> const& f);
+
+    // Length of a without leading zero limbs
+    size_t normalized(uint64_t const* a, size_t n);
+
+    // res[0..n) = a[0..n) + b[0..n), returns carry
+    uint64_t add_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n);
+
+    // res[0..n) = a[0..n) - b[0..n), returns borrow
+    uint64_t sub_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n);
+
+    // res[0..n) = a[0..n) + b[0..m), n >= m, returns carry
+    uint64_t add(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // res[0..n) = a[0..n) - b[0..m), n >= m, returns borrow
+    uint64_t sub(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // res[0..n) = -a[0..n) mod B^n, the two's complement. Returns 1 unless a is zero. res may be a.
+    uint64_t neg(uint64_t* res, uint64_t const* a, size_t n);
+
+    // Sign of a[0..n) - b[0..m): -1, 0 or 1
+    int cmp(uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // res[0..n) = a[0..n) * k, returns the high limb
+    uint64_t mul_1(uint64_t* res, uint64_t const* a, size_t n, uint64_t k);
+
+    // res[0..n) += a[0..n) * k, returns the high limb
+    uint64_t addmul_1(uint64_t* res, uint64_t const* a, size_t n, uint64_t k);
+
+    // res[0..n) = a[0..n) / k, returns the remainder
+    uint64_t div_1(uint64_t* res, uint64_t const* a, size_t n, uint64_t k);
+
+    // res[0..n) = a[0..n) & b[0..n), the same for | and ^. Long arrays go through AVX2 when
+    // the CPU has it. res may be a or b.
+    void and_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n);
+    void or_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n);
+    void xor_n(uint64_t* res, uint64_t const* a, uint64_t const* b, size_t n);
+
+    // res[0..n) = a[0..n) << s, 0 <= s < 64, returns the bits shifted out.
+    // res may overlap with a if res >= a.
+    uint64_t lshift(uint64_t* res, uint64_t const* a, size_t n, unsigned s);
+
+    // res[0..n) = a[0..n) >> s, 0 <= s < 64, returns the bits shifted out (in the high bits).
+    // res may overlap with a if res <= a.
+    uint64_t rshift(uint64_t* res, uint64_t const* a, size_t n, unsigned s);
+
+    // res[0..n + m) = a[0..n) * b[0..m) by the schoolbook method
+    void mul_basecase(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // res[0..2n) = a[0..n)^2 by the schoolbook method, computing each cross product once
+    void sqr_basecase(uint64_t* res, uint64_t const* a, size_t n);
+
+    // res[0..2n) = a[0..n)^2, picks an algorithm by size. res must not overlap with a.
+    void sqr(uint64_t* res, uint64_t const* a, size_t n);
+
+    // res[0..n + m) = a[0..n) * b[0..m) by number-theoretic transform (limbs_ntt.cpp)
+    void mul_ntt(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // res[0..n + m) = a[0..n) * b[0..m), picks an algorithm by operand sizes.
+    // Goes to sqr when a and b are the same array. res must not overlap with a or b.
+    void mul(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // q[0..n - m) = a[0..n) / b[0..m), the remainder is left in a[0..m) (limbs_div.cpp).
+    // b must be normalized (top bit of b[m - 1] set) and a[n - m..n) < b.
+    void divrem_basecase(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m);
+
+    // The same by Burnikel-Ziegler recursion on top of mul
+    void divrem_bz(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m);
+
+    // The same by Barrett reduction with a reciprocal of b found by Newton iteration
+    void divrem_newton(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m);
+
+    // The same, picking one of the three by sizes like divrem. Divides a buffer the caller has
+    // already normalized in place, without the copy divrem makes.
+    void divrem_normalized(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m);
+
+    // a[0..n) mod b[0..m) left in a[0..m) by Barrett steps with x[0..m + 1) = reciprocal(b),
+    // for a fixed b whose reciprocal is computed once. b must be normalized and a[n - m..n) < b.
+    void mod_barrett(uint64_t* a, size_t n, uint64_t const* b, size_t m, uint64_t const* x);
+
+    // x[0..m + 1) = floor(B^2m / b[0..m)), B = 2^64, b must be normalized
+    void reciprocal(uint64_t* x, uint64_t const* b, size_t m);
+
+    // q[0..n - m + 1) = a[0..n) / b[0..m), r[0..m) = a[0..n) % b[0..m), picks an algorithm
+    // by divisor size. n >= m, b[m - 1] != 0, q must not overlap with a or b. r may be a or b
+    // (both are read before r is written), otherwise it must not overlap with them.
+    void divrem(uint64_t* q, uint64_t* r, uint64_t const* a, size_t n, uint64_t const* b, size_t m);
+
+    // The same with the normalized copies of a and b in scratch[0..n + m + 1) instead of
+    // temporary vectors
+    void divrem(uint64_t* q, uint64_t* r, uint64_t const* a, size_t n, uint64_t const* b, size_t m,
+                uint64_t* scratch);
+
+    // -m0^-1 mod B for an odd m0, the constant of Montgomery reduction (limbs_mod.cpp)
+    uint64_t mont_inverse(uint64_t m0);
+
+    // res[0..n) = t[0..2n) * B^-n mod m[0..n) for an odd m and t < m * B^n, minv = mont_inverse(m[0]).
+    // t is destroyed, res must not overlap with it.
+    void redc(uint64_t* res, uint64_t* t, uint64_t const* m, size_t n, uint64_t minv);
+
+    // res[0..n) = a[0..n)^e[0..k) mod m[0..n) by a sliding window over the bits of e, in Montgomery
+    // form for an odd m. a < m, e[k - 1] != 0 and m[n - 1] != 0, res must not overlap with the others.
+    void powmod(uint64_t* res, uint64_t const* a, uint64_t const* e, size_t k, uint64_t const* m, size_t n);
+
+    // Decimal digits of a[0..n) without leading zeros, empty for zero (limbs_conv.cpp)
+    std::string to_decimal(uint64_t const* a, size_t n);
+
+    // Magnitude (without leading zero limbs) of the decimal number s[0..len), s holds digits only
+    std::vector<uint64_t> from_decimal(char const* s, size_t len);
+}
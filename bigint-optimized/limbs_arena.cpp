@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "limbs.h"
+
+namespace limbs {
+    namespace {
+        // Blocks are never moved, so earlier allocations stay valid while the arena grows.
+        // block and used are the position of the top, frames are the number of open frames.
+        struct arena {
+            std::vector<std::unique_ptr<uint64_t[]>> blocks;
+            std::vector<size_t> sizes;
+            size_t block = 0;
+            size_t used = 0;
+            size_t frames = 0;
+        };
+
+        // The smallest block, in limbs
+        constexpr size_t MIN_BLOCK = 4096;
+        // The most a thread keeps between operations, in limbs (8 MiB)
+        constexpr size_t MAX_RETAINED = size_t(1) << 20;
+
+        thread_local arena current;
+    }
+
+    arena_frame::arena_frame(): block(current.block), used(current.used) {
+        current.frames++;
+    }
+
+    arena_frame::~arena_frame() {
+        current.block = block;
+        current.used = used;
+        current.frames--;
+        if (current.frames == 0 && (current.blocks.size() > 1 || (!current.sizes.empty() && current.sizes[0] > MAX_RETAINED))) {
+            size_t total = 0;
+            for (size_t s : current.sizes) {
+                total += s;
+            }
+            total = std::min(total, MAX_RETAINED);
+            current.blocks.clear();
+            current.sizes.clear();
+            current.blocks.emplace_back(new uint64_t[total]);
+            current.sizes.push_back(total);
+        }
+    }
+
+    uint64_t* arena_frame::alloc(size_t n) {
+        assert(current.frames > 0);
+        while (current.block < current.blocks.size() && current.used + n > current.sizes[current.block]) {
+            current.block++;
+            current.used = 0;
+        }
+        if (current.block == current.blocks.size()) {
+            size_t size = std::max(n, current.sizes.empty() ? MIN_BLOCK : 2 * current.sizes.back());
+            current.blocks.emplace_back(new uint64_t[size]);
+            current.sizes.push_back(size);
+        }
+        uint64_t* res = current.blocks[current.block].get() + current.used;
+        current.used += n;
+        return res;
+    }
+}
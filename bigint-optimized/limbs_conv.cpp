@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "limbs.h"
+
+namespace limbs {
+    namespace {
+        // The largest power of ten in a limb and its number of digits
+        constexpr uint64_t DECIMAL_BASE = 10000000000000000000ULL;
+        constexpr size_t DECIMAL_DIGITS = 19;
+
+        // powers[i] = 10^(19 * 2^i), while the next one is at most about half of n limbs
+        std::vector<std::vector<uint64_t>> powers_of_ten(size_t n) {
+            std::vector<std::vector<uint64_t>> powers(1, std::vector<uint64_t>(1, DECIMAL_BASE));
+            while (2 * (2 * powers.back().size() - 1) <= n + 1) {
+                std::vector<uint64_t> const& p = powers.back();
+                std::vector<uint64_t> next(2 * p.size());
+                sqr(next.data(), p.data(), p.size());
+                next.resize(normalized(next.data(), next.size()));
+                powers.push_back(next);
+            }
+            return powers;
+        }
+
+        // Writes a[0..n) as exactly len digits ending at out + len, padded with leading zeros
+        void to_decimal_basecase(char* out, size_t len, uint64_t const* a, size_t n) {
+            arena_frame frame;
+            uint64_t* t = frame.alloc(n);
+            std::copy_n(a, n, t);
+            char* p = out + len;
+            while (n > 0) {
+                uint64_t r = div_1(t, t, n, DECIMAL_BASE);
+                n = normalized(t, n);
+                for (size_t i = 0; i < DECIMAL_DIGITS && (n > 0 || r > 0); i++) {
+                    assert(p > out);
+                    *--p = static_cast<char>('0' + r % 10);
+                    r /= 10;
+                }
+            }
+            std::fill(out, p, '0');
+        }
+
+        // The same, splitting a by powers[k] into halves of about equal size
+        void to_decimal_rec(char* out, size_t len, uint64_t const* a, size_t n,
+                            std::vector<std::vector<uint64_t>> const& powers, size_t k) {
+            n = normalized(a, n);
+            if (n < TO_DECIMAL_THRESHOLD) {
+                to_decimal_basecase(out, len, a, n);
+                return;
+            }
+            while (k > 0 && 2 * powers[k].size() > n + 1) {
+                k--;
+            }
+            std::vector<uint64_t> const& p = powers[k];
+            size_t m = p.size();
+            arena_frame frame;
+            uint64_t* q = frame.alloc(n - m + 1);
+            uint64_t* r = frame.alloc(m);
+            divrem(q, r, a, n, p.data(), m);
+            size_t low = DECIMAL_DIGITS << k;
+            assert(low <= len);
+            to_decimal_rec(out + len - low, low, r, m, powers, k);
+            to_decimal_rec(out, len - low, q, n - m + 1, powers, k);
+        }
+    }
+
+    namespace {
+        // Horner's scheme over 19-digit chunks, the first chunk takes the remainder of len
+        std::vector<uint64_t> from_decimal_basecase(char const* s, size_t len) {
+            std::vector<uint64_t> res;
+            size_t chunk = (len % DECIMAL_DIGITS == 0 ? DECIMAL_DIGITS : len % DECIMAL_DIGITS);
+            for (size_t i = 0; i < len; i += chunk, chunk = DECIMAL_DIGITS) {
+                uint64_t c = 0;
+                for (size_t j = i; j < i + chunk; j++) {
+                    c = c * 10 + static_cast<uint64_t>(s[j] - '0');
+                }
+                uint64_t high = mul_1(res.data(), res.data(), res.size(), DECIMAL_BASE);
+                res.push_back(high);
+                add(res.data(), res.data(), res.size(), &c, 1);
+            }
+            res.resize(normalized(res.data(), res.size()));
+            return res;
+        }
+
+        // s = high * 10^(19 * 2^k) + low, where low takes the largest such power shorter than s
+        std::vector<uint64_t> from_decimal_rec(char const* s, size_t len,
+                                               std::vector<std::vector<uint64_t>> const& powers, size_t k) {
+            if (len < FROM_DECIMAL_THRESHOLD * DECIMAL_DIGITS) {
+                return from_decimal_basecase(s, len);
+            }
+            while (k > 0 && (DECIMAL_DIGITS << k) >= len) {
+                k--;
+            }
+            size_t low_len = DECIMAL_DIGITS << k;
+            std::vector<uint64_t> high = from_decimal_rec(s, len - low_len, powers, k);
+            std::vector<uint64_t> low = from_decimal_rec(s + len - low_len, low_len, powers, k);
+            if (high.empty()) {
+                return low;
+            }
+            std::vector<uint64_t> const& p = powers[k];
+            std::vector<uint64_t> res(high.size() + p.size());
+            mul(res.data(), high.data(), high.size(), p.data(), p.size());
+            if (!low.empty()) {
+                add(res.data(), res.data(), res.size(), low.data(), low.size());
+            }
+            res.resize(normalized(res.data(), res.size()));
+            return res;
+        }
+    }
+
+    std::string to_decimal(uint64_t const* a, size_t n) {
+        n = normalized(a, n);
+        // 64 * log10(2) < 19.27 digits per limb
+        std::string res(n * 20 + 1, '0');
+        std::vector<std::vector<uint64_t>> powers = powers_of_ten(n);
+        to_decimal_rec(&res[0], res.size(), a, n, powers, powers.size() - 1);
+        res.erase(0, std::min(res.find_first_not_of('0'), res.size()));
+        return res;
+    }
+
+    std::vector<uint64_t> from_decimal(char const* s, size_t len) {
+        // 19.26 digits per limb
+        std::vector<std::vector<uint64_t>> powers = powers_of_ten(len / 19 + 1);
+        return from_decimal_rec(s, len, powers, powers.size() - 1);
+    }
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cassert>
+#include "limbs.h"
+
+namespace limbs {
+    namespace {
+        // w[0..m] -= b[0..m) * k, returns borrow
+        uint64_t submul_1(uint64_t* w, uint64_t const* b, size_t m, uint64_t k) {
+            uint128_t mc = 0;
+            uint64_t c = 0;
+            for (size_t j = 0; j < m; j++) {
+                mc += static_cast<uint128_t>(b[j]) * k;
+                uint128_t d = static_cast<uint128_t>(w[j]) - static_cast<uint64_t>(mc) - c;
+                w[j] = static_cast<uint64_t>(d);
+                c = static_cast<uint64_t>(d >> 127);
+                mc >>= 64;
+            }
+            uint128_t d = static_cast<uint128_t>(w[m]) - mc - c;
+            w[m] = static_cast<uint64_t>(d);
+            return static_cast<uint64_t>(d >> 127);
+        }
+
+        // res[0..n + m + 1) = a[0..n) * x[0..m + 1) where x[m] is a small reciprocal top limb.
+        // Keeps the product at n + m limbs for mul, one more limb could double the NTT length.
+        void mul_reciprocal(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* x, size_t m) {
+            mul(res, a, n, x, m);
+            res[n + m] = 0;
+            arena_frame frame;
+            uint64_t* t = frame.alloc(n + 1);
+            t[n] = mul_1(t, a, n, x[m]);
+            add(res + m, res + m, n + 1, t, n + 1);
+        }
+
+        // Barrett step on the window w[0..2m), w[m..2m) < b: q[0..m) = w / b with the remainder
+        // left in w[0..m). The estimate floor(w_high * x / B^m) is at most a few units below
+        // the true quotient. t and p are scratch of 2m + 1 and 2m limbs.
+        void barrett_step(uint64_t* q, uint64_t* w, uint64_t const* b, size_t m, uint64_t const* x,
+                          uint64_t* t, uint64_t* p) {
+            mul_reciprocal(t, w + m, m, x, m);
+            assert(t[2 * m] == 0);
+            std::copy_n(t + m, m, q);
+            mul(p, q, m, b, m);
+            sub_n(w, w, p, 2 * m);
+            uint64_t const one = 1;
+            while (cmp(w, m + 1, b, m) >= 0) {
+                sub(w, w, m + 1, b, m);
+                add(q, q, m, &one, 1);
+            }
+        }
+    }
+
+    // Knuth's algorithm D: every quotient limb is estimated from the top two limbs of the
+    // window and the top two limbs of b, the estimate is at most one too large after refinement.
+    void divrem_basecase(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m) {
+        assert(m > 0 && n >= m && (b[m - 1] >> 63) != 0);
+        uint64_t top = b[m - 1];
+        uint128_t next = (m > 1 ? b[m - 2] : 0);
+        for (size_t i = n - m; i > 0; i--) {
+            // the window w[0..m] holds the current remainder, w[m] <= top
+            uint64_t* w = a + i - 1;
+            uint128_t qt, rt;
+            if (w[m] >= top) {
+                qt = UINT64_MAX;
+                rt = static_cast<uint128_t>(w[m - 1]) + top;
+            } else {
+                uint64_t r;
+                qt = div_2_1(w[m], w[m - 1], top, r);
+                rt = r;
+            }
+            while (m > 1 && rt <= UINT64_MAX && qt * next > ((rt << 64) | w[m - 2])) {
+                qt--;
+                rt += top;
+            }
+            if (submul_1(w, b, m, static_cast<uint64_t>(qt))) {
+                qt--;
+                w[m] += add_n(w, w, b, m);
+            }
+            assert(w[m] == 0);
+            q[i - 1] = static_cast<uint64_t>(qt);
+        }
+    }
+
+    namespace {
+        void div_2n_1n(uint64_t* q, uint64_t* a, uint64_t const* b, size_t n);
+
+        // q[0..k) = a[0..n + k) / b[0..n), remainder left in a[0..n), k < n, a[k..n + k) < b.
+        // The top 2k limbs of a are divided by the top k limbs of b, which gives a quotient
+        // at most two too large, then the rest of b is subtracted and the quotient corrected.
+        void div_3n_2n(uint64_t* q, uint64_t* a, uint64_t const* b, size_t n, size_t k) {
+            assert(k < n);
+            uint64_t const* bh = b + n - k;
+            int64_t top = 0;
+            if (cmp(a + n, k, bh, k) < 0) {
+                div_2n_1n(q, a + n - k, bh, k);
+            } else {
+                // a[n..n + k) == bh, so the quotient is B^k - 1 and a - q * bh * B^(n - k) only adds bh
+                std::fill_n(q, k, UINT64_MAX);
+                top = add_n(a + n - k, a + n - k, bh, k);
+            }
+            arena_frame frame;
+            uint64_t* d = frame.alloc(n);
+            mul(d, q, k, b, n - k);
+            top -= sub_n(a, a, d, n);
+            uint64_t const one = 1;
+            while (top < 0) {
+                top += add_n(a, a, b, n);
+                sub(q, q, k, &one, 1);
+            }
+        }
+
+        // q[0..n) = a[0..2n) / b[0..n), remainder left in a[0..n), a[n..2n) < b.
+        // The quotient is found in two halves, each by a div_3n_2n step.
+        void div_2n_1n(uint64_t* q, uint64_t* a, uint64_t const* b, size_t n) {
+            if (n < BZ_THRESHOLD) {
+                divrem_basecase(q, a, 2 * n, b, n);
+                return;
+            }
+            size_t lo = n / 2;
+            size_t hi = n - lo;
+            div_3n_2n(q + lo, a + lo, b, n, hi);
+            div_3n_2n(q, a, b, n, lo);
+        }
+    }
+
+    // a is consumed from the top in blocks of m limbs, each block is a 2m by m (or shorter) division
+    void divrem_bz(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m) {
+        assert(m > 0 && n >= m && (b[m - 1] >> 63) != 0);
+        for (size_t i = n - m; i > 0;) {
+            size_t k = std::min(i, m);
+            i -= k;
+            if (k == m) {
+                div_2n_1n(q + i, a + i, b, m);
+            } else {
+                div_3n_2n(q + i, a + i, b, m, k);
+            }
+        }
+    }
+
+    // Newton step from a half-size reciprocal: with X0 = (xh - 4) * B^l a lower bound of B^2m / b,
+    // X1 = X0 + X0 * (B^2m - b * X0) / B^2m is still a lower bound and off by a few units at most.
+    void reciprocal(uint64_t* x, uint64_t const* b, size_t m) {
+        assert(m > 0 && (b[m - 1] >> 63) != 0);
+        arena_frame frame;
+        if (m < NEWTON_THRESHOLD) {
+            uint64_t* a = frame.alloc(2 * m + 1);
+            uint64_t* q = frame.alloc(m + 2);
+            uint64_t* r = frame.alloc(m);
+            std::fill_n(a, 2 * m, 0);
+            a[2 * m] = 1;
+            divrem(q, r, a, 2 * m + 1, b, m);
+            std::copy_n(q, m + 1, x);
+            return;
+        }
+        size_t h = (m + 1) / 2;
+        size_t l = m - h;
+        uint64_t const four = 4;
+        uint64_t* xh = frame.alloc(h + 1);
+        reciprocal(xh, b + l, h);
+        sub(xh, xh, h + 1, &four, 1);
+
+        // b * X0 = t * B^l <= B^2m, so e = (B^2m - b * X0) / B^l = B^(m + h) - t, and e < 5 * B^m
+        uint64_t* t = frame.alloc(m + h + 1);
+        uint64_t* e = frame.alloc(m + h);
+        mul_reciprocal(t, b, m, xh, h);
+        std::fill_n(e, m + h, 0);
+        sub_n(e, e, t, m + h);
+        assert(normalized(e, m + h) <= m + 1);
+
+        // X1 = X0 + (xh - 4) * e / B^2h, the low h - 1 limbs of e change it by less than one
+        uint64_t* d = frame.alloc(m + 3);
+        mul_reciprocal(d, e + h - 1, l + 2, xh, h);
+        std::fill_n(x, l, 0);
+        std::copy_n(xh, h + 1, x + l);
+        uint64_t c = add(x, x, m + 1, d + h + 1, l + 2);
+        assert(c == 0);
+        (void) c;
+
+        // bring X1 up to floor(B^2m / b) with the exact remainder B^2m - b * X1
+        uint64_t* p = frame.alloc(2 * m + 1);
+        uint64_t* r = frame.alloc(2 * m);
+        mul_reciprocal(p, b, m, x, m);
+        std::fill_n(r, 2 * m, 0);
+        sub_n(r, r, p, 2 * m);
+        uint64_t const one = 1;
+        while (cmp(r, m + 1, b, m) >= 0) {
+            sub(r, r, m + 1, b, m);
+            add(x, x, m + 1, &one, 1);
+        }
+    }
+
+    // The partial top block goes to divrem_bz, every full 2m by m block is a Barrett step
+    void divrem_newton(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m) {
+        assert(m > 0 && n >= m && (b[m - 1] >> 63) != 0);
+        size_t i = n - m;
+        size_t k = i % m;
+        if (k > 0) {
+            i -= k;
+            divrem_bz(q + i, a + i, m + k, b, m);
+        }
+        if (i == 0) {
+            return;
+        }
+        arena_frame frame;
+        uint64_t* x = frame.alloc(m + 1);
+        uint64_t* t = frame.alloc(2 * m + 1);
+        uint64_t* p = frame.alloc(2 * m);
+        reciprocal(x, b, m);
+        while (i > 0) {
+            i -= m;
+            barrett_step(q + i, a + i, b, m, x, t, p);
+        }
+    }
+
+    // The same blocks as divrem_newton with the quotient thrown away
+    void mod_barrett(uint64_t* a, size_t n, uint64_t const* b, size_t m, uint64_t const* x) {
+        assert(m > 0 && n >= m && (b[m - 1] >> 63) != 0);
+        arena_frame frame;
+        uint64_t* q = frame.alloc(m);
+        size_t i = n - m;
+        size_t k = i % m;
+        if (k > 0) {
+            i -= k;
+            divrem_bz(q, a + i, m + k, b, m);
+        }
+        uint64_t* t = frame.alloc(2 * m + 1);
+        uint64_t* p = frame.alloc(2 * m);
+        while (i > 0) {
+            i -= m;
+            barrett_step(q, a + i, b, m, x, t, p);
+        }
+    }
+
+    // The Newton reciprocal pays off once a holds more than four blocks of m limbs
+    void divrem_normalized(uint64_t* q, uint64_t* a, size_t n, uint64_t const* b, size_t m) {
+        if (m < BZ_THRESHOLD) {
+            divrem_basecase(q, a, n, b, m);
+        } else if (m < NEWTON_THRESHOLD || n <= 4 * m) {
+            divrem_bz(q, a, n, b, m);
+        } else {
+            divrem_newton(q, a, n, b, m);
+        }
+    }
+
+    void divrem(uint64_t* q, uint64_t* r, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        arena_frame frame;
+        divrem(q, r, a, n, b, m, frame.alloc(n + m + 1));
+    }
+
+    void divrem(uint64_t* q, uint64_t* r, uint64_t const* a, size_t n, uint64_t const* b, size_t m,
+                uint64_t* scratch) {
+        assert(m > 0 && n >= m && b[m - 1] != 0);
+        if (m == 1) {
+            r[0] = div_1(q, a, n, b[0]);
+            return;
+        }
+        // shift both so that the top bit of b is set, the extra top limb keeps a[n - m + 1..n + 1) < b
+        unsigned s = __builtin_clzll(b[m - 1]);
+        uint64_t* an = scratch;
+        uint64_t* bn = scratch + n + 1;
+        lshift(bn, b, m, s);
+        an[n] = lshift(an, a, n, s);
+        divrem_normalized(q, an, n + 1, bn, m);
+        rshift(r, an, m, s);
+    }
+}
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cassert>
+#include "limbs.h"
+
+namespace limbs {
+    uint64_t mont_inverse(uint64_t m0) {
+        assert((m0 & 1) != 0);
+        // Newton iteration x = x * (2 - m0 * x) doubles the correct low bits,
+        // m0 itself is right in the low 3 bits
+        uint64_t x = m0;
+        for (int i = 0; i < 5; i++) {
+            x *= 2 - m0 * x;
+        }
+        return -x;
+    }
+
+    // Every pass clears the low limb t[i] and leaves the carry out of t[i + n] in its place,
+    // the carries are added all at once at the end. t < m * R gives a result below 2m.
+    void redc(uint64_t* res, uint64_t* t, uint64_t const* m, size_t n, uint64_t minv) {
+        for (size_t i = 0; i < n; i++) {
+            t[i] = addmul_1(t + i, m, n, t[i] * minv);
+        }
+        if (add_n(res, t + n, t, n) != 0 || cmp(res, n, m, n) >= 0) {
+            sub_n(res, res, m, n);
+        }
+    }
+
+    namespace {
+        // Exponent bits per window by the bit length of the exponent, the table of 2^(k - 1)
+        // odd powers pays off against the multiplications it saves
+        size_t window_bits(size_t bits) {
+            size_t const limits[] = {24, 80, 240, 672, 1792};
+            size_t k = 1;
+            while (k <= 5 && bits > limits[k - 1]) {
+                k++;
+            }
+            return k;
+        }
+
+        bool exponent_bit(uint64_t const* e, size_t i) {
+            return ((e[i / 64] >> (i % 64)) & 1) != 0;
+        }
+
+        // res[0..n) = a^e with the products reduced by mulmod(res, x, y), res may be x or y.
+        // Left-to-right sliding window over e[0..k), e[k - 1] != 0: every window starts and ends
+        // with a set bit, so only the odd powers a, a^3, ..., a^(2^w - 1) are tabulated.
+        template<typename MulMod>
+        void window_pow(uint64_t* res, uint64_t const* a, uint64_t const* e, size_t k, size_t n,
+                        MulMod const& mulmod) {
+            size_t bits = 64 * k - __builtin_clzll(e[k - 1]);
+            size_t w = window_bits(bits);
+            arena_frame frame;
+            uint64_t* table = frame.alloc(n << (w - 1));
+            std::copy_n(a, n, table);
+            if (w > 1) {
+                uint64_t* a2 = frame.alloc(n);
+                mulmod(a2, a, a);
+                for (size_t j = 1; j < (size_t(1) << (w - 1)); j++) {
+                    mulmod(table + j * n, table + (j - 1) * n, a2);
+                }
+            }
+            bool started = false;
+            for (size_t i = bits; i > 0;) {
+                if (!exponent_bit(e, i - 1)) {
+                    mulmod(res, res, res);
+                    i--;
+                    continue;
+                }
+                // the window [l, i) has its top and bottom bits set
+                size_t l = (i > w ? i - w : 0);
+                while (!exponent_bit(e, l)) {
+                    l++;
+                }
+                size_t value = 0;
+                for (size_t j = i; j-- > l;) {
+                    value = 2 * value + exponent_bit(e, j);
+                }
+                if (started) {
+                    for (size_t j = l; j < i; j++) {
+                        mulmod(res, res, res);
+                    }
+                    mulmod(res, res, table + (value / 2) * n);
+                } else {
+                    std::copy_n(table + (value / 2) * n, n, res);
+                    started = true;
+                }
+                i = l;
+            }
+        }
+    }
+
+    // An odd m works in Montgomery form, a * R mod m, where a product needs a REDC instead of
+    // a division. An even m divides every product.
+    void powmod(uint64_t* res, uint64_t const* a, uint64_t const* e, size_t k, uint64_t const* m, size_t n) {
+        assert(n > 0 && m[n - 1] != 0 && k > 0 && e[k - 1] != 0 && cmp(a, n, m, n) < 0);
+        arena_frame frame;
+        uint64_t* t = frame.alloc(2 * n);
+        if ((m[0] & 1) == 0) {
+            uint64_t* q = frame.alloc(n + 1);
+            uint64_t* scratch = frame.alloc(3 * n + 1);
+            window_pow(res, a, e, k, n, [&](uint64_t* r, uint64_t const* x, uint64_t const* y) {
+                mul(t, x, n, y, n);
+                divrem(q, r, t, 2 * n, m, n, scratch);
+            });
+            return;
+        }
+        uint64_t minv = mont_inverse(m[0]);
+        uint64_t* am = frame.alloc(n);
+        std::fill_n(t, n, 0);
+        std::copy_n(a, n, t + n);
+        divrem(frame.alloc(n + 1), am, t, 2 * n, m, n);
+        window_pow(res, am, e, k, n, [&](uint64_t* r, uint64_t const* x, uint64_t const* y) {
+            mul(t, x, n, y, n);
+            redc(r, t, m, n, minv);
+        });
+        std::copy_n(res, n, t);
+        std::fill_n(t + n, n, 0);
+        redc(res, t, m, n, minv);
+    }
+}
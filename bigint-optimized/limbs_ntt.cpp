@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "limbs.h"
+
+// Multiplication by number-theoretic transform modulo three 62-bit primes of the form c * 2^k + 1.
+// A coefficient of the product of two uint64_t sequences is at most min(n, m) * 2^128,
+// which is far below p1 * p2 * p3 (about 2^183), so the exact coefficient is restored by CRT.
+namespace limbs {
+    namespace {
+        // Arithmetic modulo p < 2^62 in Montgomery form with R = 2^64
+        struct montgomery {
+            uint64_t p;
+            // -p^-1 mod 2^64
+            uint64_t p_neg_inv;
+            // R^2 mod p
+            uint64_t r2;
+
+            explicit montgomery(uint64_t p): p(p) {
+                uint64_t inv = p;
+                for (int i = 0; i < 5; i++) {
+                    inv *= 2 - p * inv;
+                }
+                p_neg_inv = -inv;
+                uint64_t r = static_cast<uint64_t>((static_cast<uint128_t>(1) << 64) % p);
+                r2 = static_cast<uint64_t>(static_cast<uint128_t>(r) * r % p);
+            }
+
+            // a * b * R^-1 mod p
+            uint64_t mul(uint64_t a, uint64_t b) const {
+                uint128_t t = static_cast<uint128_t>(a) * b;
+                uint64_t m = static_cast<uint64_t>(t) * p_neg_inv;
+                uint64_t u = static_cast<uint64_t>((t + static_cast<uint128_t>(m) * p) >> 64);
+                return u >= p ? u - p : u;
+            }
+
+            uint64_t add(uint64_t a, uint64_t b) const {
+                uint64_t s = a + b;
+                return s >= p ? s - p : s;
+            }
+
+            uint64_t sub(uint64_t a, uint64_t b) const {
+                return a >= b ? a - b : a + p - b;
+            }
+
+            uint64_t to_mont(uint64_t a) const {
+                return mul(a, r2);
+            }
+
+            uint64_t from_mont(uint64_t a) const {
+                return mul(a, 1);
+            }
+
+            // x^e, x and result in Montgomery form
+            uint64_t pow(uint64_t x, uint64_t e) const {
+                uint64_t res = to_mont(1);
+                for (; e > 0; e >>= 1) {
+                    if (e & 1) {
+                        res = mul(res, x);
+                    }
+                    x = mul(x, x);
+                }
+                return res;
+            }
+        };
+
+        struct ntt_prime {
+            uint64_t p;
+            // primitive root modulo p
+            uint64_t g;
+        };
+
+        // 29 * 2^57 + 1, 69 * 2^55 + 1 and 27 * 2^56 + 1
+        ntt_prime const PRIMES[] = {{4179340454199820289ULL, 3}, {2485986994308513793ULL, 5},
+                                    {1945555039024054273ULL, 5}};
+
+        // A parallel task takes at least this many elements
+        constexpr size_t GRAIN = 8192;
+
+        // Number of tasks for n elements, 1 unless there are worker threads and enough work for them
+        size_t task_count(size_t n) {
+            return (threads() > 1 && n >= 2 * GRAIN ? std::min(n / GRAIN, 8 * threads()) : 1);
+        }
+
+        // f(from, to) over consecutive ranges covering [0, n), in parallel for long ranges
+        template<typename F>
+        void for_ranges(size_t n, F const& f) {
+            size_t tasks = task_count(n);
+            if (tasks == 1) {
+                f(0, n);
+                return;
+            }
+            parallel_for(tasks, [&](size_t t) {
+                f(n * t / tasks, n * (t + 1) / tasks);
+            });
+        }
+
+        // Transform of length L (power of two) modulo one prime. Twiddles are kept in Montgomery form,
+        // so multiplying a plain residue by one of them yields a plain residue.
+        class ntt {
+        public:
+            ntt(ntt_prime const& prime, size_t len): mod(prime.p), len(len), roots(len), inv_roots(len) {
+                for (size_t h = 1; h < len; h *= 2) {
+                    // primitive 2h-th root of unity and its inverse
+                    uint64_t w = mod.pow(mod.to_mont(prime.g), (prime.p - 1) / (2 * h));
+                    uint64_t w_inv = mod.pow(w, prime.p - 2);
+                    for_ranges(h, [&](size_t from, size_t to) {
+                        uint64_t r = mod.pow(w, from);
+                        uint64_t r_inv = mod.pow(w_inv, from);
+                        for (size_t j = from; j < to; j++) {
+                            roots[h + j] = r;
+                            inv_roots[h + j] = r_inv;
+                            r = mod.mul(r, w);
+                            r_inv = mod.mul(r_inv, w_inv);
+                        }
+                    });
+                }
+            }
+
+            // Decimation in frequency, natural order in, bit-reversed order out
+            void forward(uint64_t* a) const {
+                for (size_t h = len / 2; h >= 1; h /= 2) {
+                    butterflies(h, [&](size_t s, size_t j) {
+                        uint64_t u = a[s + j];
+                        uint64_t v = a[s + j + h];
+                        a[s + j] = mod.add(u, v);
+                        a[s + j + h] = mod.mul(mod.sub(u, v), roots[h + j]);
+                    });
+                }
+            }
+
+            // Decimation in time, bit-reversed order in, natural order out, not scaled by 1/L
+            void inverse(uint64_t* a) const {
+                for (size_t h = 1; h < len; h *= 2) {
+                    butterflies(h, [&](size_t s, size_t j) {
+                        uint64_t u = a[s + j];
+                        uint64_t v = mod.mul(a[s + j + h], inv_roots[h + j]);
+                        a[s + j] = mod.add(u, v);
+                        a[s + j + h] = mod.sub(u, v);
+                    });
+                }
+            }
+
+            // Cyclic convolution of a and b modulo p, result in a. b == nullptr means a with itself.
+            void convolve(std::vector<uint64_t>& a, std::vector<uint64_t>* b) const {
+                forward(a.data());
+                uint64_t const* fb = a.data();
+                if (b != nullptr) {
+                    forward(b->data());
+                    fb = b->data();
+                }
+                // The pointwise product carries an extra R^-1 and the inverse transform an extra L,
+                // multiplying by R^2 / L in Montgomery form cancels both
+                uint64_t scale = mod.to_mont(mod.pow(mod.to_mont(len % mod.p), mod.p - 2));
+                for_ranges(len, [&](size_t from, size_t to) {
+                    for (size_t i = from; i < to; i++) {
+                        a[i] = mod.mul(a[i], fb[i]);
+                    }
+                });
+                inverse(a.data());
+                for_ranges(len, [&](size_t from, size_t to) {
+                    for (size_t i = from; i < to; i++) {
+                        a[i] = mod.mul(a[i], scale);
+                    }
+                });
+            }
+
+        private:
+            // f(s, j) for every butterfly of the stage with half-length h: blocks s of 2h elements
+            // and j < h. The len / 2 butterflies are independent, they are split into ranges
+            // of the flattened (s, j) order.
+            template<typename F>
+            void butterflies(size_t h, F const& f) const {
+                for_ranges(len / 2, [&](size_t from, size_t to) {
+                    size_t b = from;
+                    while (b < to) {
+                        size_t s = b / h * 2 * h;
+                        size_t j = b % h;
+                        size_t end = std::min(h, j + (to - b));
+                        b += end - j;
+                        for (; j < end; j++) {
+                            f(s, j);
+                        }
+                    }
+                });
+            }
+
+            montgomery const mod;
+            size_t len;
+            // roots[h + j] = w_2h^j for every power of two h < L
+            std::vector<uint64_t> roots;
+            std::vector<uint64_t> inv_roots;
+        };
+
+        // a[0..n) reduced modulo p, zero-padded to len
+        std::vector<uint64_t> residues(uint64_t const* a, size_t n, uint64_t p, size_t len) {
+            std::vector<uint64_t> f(len, 0);
+            for_ranges(n, [&](size_t from, size_t to) {
+                for (size_t i = from; i < to; i++) {
+                    f[i] = a[i] % p;
+                }
+            });
+            return f;
+        }
+
+        // Residues of the product modulo one prime
+        std::vector<uint64_t> convolve_mod(ntt_prime const& prime, size_t len,
+                                           uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+            ntt t(prime, len);
+            std::vector<uint64_t> fa = residues(a, n, prime.p, len);
+            if (a == b && n == m) {
+                t.convolve(fa, nullptr);
+            } else {
+                std::vector<uint64_t> fb = residues(b, m, prime.p, len);
+                t.convolve(fa, &fb);
+            }
+            return fa;
+        }
+
+        // Inverse of x modulo p in Montgomery form
+        uint64_t inverse_mod(montgomery const& mod, uint64_t x) {
+            return mod.pow(mod.to_mont(x % mod.p), mod.p - 2);
+        }
+    }
+
+    void mul_ntt(uint64_t* res, uint64_t const* a, size_t n, uint64_t const* b, size_t m) {
+        size_t len = 1;
+        while (len < n + m) {
+            len *= 2;
+        }
+        // The three convolutions are independent, with workers each is a task of its own
+        // (and spreads its stages further)
+        std::vector<uint64_t> r[3];
+        auto convolve = [&](size_t i) {
+            r[i] = convolve_mod(PRIMES[i], len, a, n, b, m);
+        };
+        if (threads() > 1 && std::min(n, m) >= PARALLEL_THRESHOLD) {
+            parallel_for(3, convolve);
+        } else {
+            for (size_t i = 0; i < 3; i++) {
+                convolve(i);
+            }
+        }
+        std::vector<uint64_t> const& r1 = r[0];
+        std::vector<uint64_t> const& r2 = r[1];
+        std::vector<uint64_t> const& r3 = r[2];
+
+        // Garner: x = r1 + p1 * k2 + p1 * p2 * k3 with
+        // k2 = (r2 - r1) / p1 mod p2, k3 = ((r3 - r1) / p1 - k2) / p2 mod p3
+        uint64_t p1 = PRIMES[0].p;
+        uint64_t p2 = PRIMES[1].p;
+        montgomery mod2(p2), mod3(PRIMES[2].p);
+        uint64_t p1_inv2 = inverse_mod(mod2, p1);
+        uint64_t p1_inv3 = inverse_mod(mod3, p1);
+        uint64_t p2_inv3 = inverse_mod(mod3, p2);
+        uint128_t p12 = static_cast<uint128_t>(p1) * p2;
+        uint64_t p12_lo = static_cast<uint64_t>(p12);
+        uint64_t p12_hi = static_cast<uint64_t>(p12 >> 64);
+        // The coefficients are split into ranges, each range is summed with its own carry
+        // c0 + c1 * 2^64 (below 2^122) and the carry out of it is added to the rest afterwards
+        size_t total = n + m;
+        size_t tasks = task_count(total);
+        std::vector<uint64_t> carries(2 * tasks);
+        auto garner = [&](size_t t) {
+            uint64_t c0 = 0, c1 = 0;
+            for (size_t i = total * t / tasks; i < total * (t + 1) / tasks; i++) {
+                uint64_t k2 = mod2.mul(mod2.sub(r2[i], r1[i] % mod2.p), p1_inv2);
+                uint64_t t3 = mod3.mul(mod3.sub(r3[i], r1[i] % mod3.p), p1_inv3);
+                uint64_t k3 = mod3.mul(mod3.sub(t3, k2 % mod3.p), p2_inv3);
+
+                uint128_t lo = static_cast<uint128_t>(p1) * k2 + r1[i];
+                uint128_t mid = static_cast<uint128_t>(p12_lo) * k3;
+                uint128_t hi = static_cast<uint128_t>(p12_hi) * k3;
+                uint128_t s = static_cast<uint128_t>(c0) + static_cast<uint64_t>(lo) + static_cast<uint64_t>(mid);
+                res[i] = static_cast<uint64_t>(s);
+                s = (s >> 64) + c1 + (lo >> 64) + (mid >> 64) + static_cast<uint64_t>(hi);
+                c0 = static_cast<uint64_t>(s);
+                c1 = static_cast<uint64_t>(s >> 64) + static_cast<uint64_t>(hi >> 64);
+            }
+            carries[2 * t] = c0;
+            carries[2 * t + 1] = c1;
+        };
+        if (tasks == 1) {
+            garner(0);
+        } else {
+            parallel_for(tasks, garner);
+        }
+        for (size_t t = 0; t + 1 < tasks; t++) {
+            size_t to = total * (t + 1) / tasks;
+            uint64_t c = add(res + to, res + to, total - to, carries.data() + 2 * t,
+                             std::min<size_t>(2, total - to));
+            assert(c == 0);
+            (void) c;
+        }
+        assert(carries[2 * tasks - 2] == 0 && carries[2 * tasks - 1] == 0);
+    }
+}
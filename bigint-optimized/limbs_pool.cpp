@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "limbs.h"
+
+namespace limbs {
+    namespace {
+        // One parallel_for call. Tasks are claimed by index under the pool mutex,
+        // by the calling thread and by any idle worker.
+        struct job {
+            std::function<void(size_t)> const* f;
+            size_t n;
+            size_t next;
+            size_t done;
+        };
+
+        // Workers sleep until a job with unclaimed tasks appears and take from the most recent one,
+        // which is the innermost when parallel_for calls nest. The caller of parallel_for works on
+        // its own job first; once all of its tasks are claimed it helps with the other jobs until
+        // its own are done, so nested calls never leave a thread blocked while there is work.
+        class pool {
+        public:
+            explicit pool(size_t workers): stop(false) {
+                for (size_t i = 0; i < workers; i++) {
+                    threads.emplace_back([this] { work(); });
+                }
+            }
+
+            ~pool() {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    stop = true;
+                }
+                changed.notify_all();
+                for (std::thread& t : threads) {
+                    t.join();
+                }
+            }
+
+            void run(size_t n, std::function<void(size_t)> const& f) {
+                job j = {&f, n, 0, 0};
+                std::unique_lock<std::mutex> lock(m);
+                jobs.push_back(&j);
+                changed.notify_all();
+                while (j.done < j.n) {
+                    if (j.next < j.n) {
+                        execute(&j, lock);
+                    } else if (!jobs.empty()) {
+                        execute(jobs.back(), lock);
+                    } else {
+                        changed.wait(lock);
+                    }
+                }
+            }
+
+        private:
+            std::vector<std::thread> threads;
+            std::deque<job*> jobs;
+            std::mutex m;
+            // signalled when a job is queued or finished
+            std::condition_variable changed;
+            bool stop;
+
+            // Claims the next task of j and runs it without the lock,
+            // a job leaves the queue with its last task
+            void execute(job* j, std::unique_lock<std::mutex>& lock) {
+                size_t i = j->next++;
+                if (j->next == j->n) {
+                    jobs.erase(std::find(jobs.begin(), jobs.end(), j));
+                }
+                lock.unlock();
+                (*j->f)(i);
+                lock.lock();
+                if (++j->done == j->n) {
+                    changed.notify_all();
+                }
+            }
+
+            void work() {
+                std::unique_lock<std::mutex> lock(m);
+                while (true) {
+                    changed.wait(lock, [this] { return stop || !jobs.empty(); });
+                    if (stop) {
+                        return;
+                    }
+                    execute(jobs.back(), lock);
+                }
+            }
+        };
+
+        size_t thread_count = 1;
+        std::unique_ptr<pool> workers;
+    }
+
+    void set_threads(size_t n) {
+        n = std::max<size_t>(n, 1);
+        workers.reset();
+        if (n > 1) {
+            workers.reset(new pool(n - 1));
+        }
+        thread_count = n;
+    }
+
+    size_t threads() {
+        return thread_count;
+    }
+
+    void parallel_for(size_t n, std::function<void(size_t)> const& f) {
+        if (!workers || n <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                f(i);
+            }
+            return;
+        }
+        workers->run(n, f);
+    }
+}
@@ -2,42 +2,70 @@
 #include <cstddef>
 #include <cstdint>
 #include <algorithm>
+#include <utility>
 
-class opt_vector {
+// Vector of limbs with copy-on-write buffers, the first N limbs are stored inline
+// (in place of the buffer pointer) and never touch the heap.
+// With AtomicRefcount the reference count of a shared buffer is updated atomically, so copies
+// of one vector may be made, modified and destroyed from different threads.
+template<size_t N, bool AtomicRefcount = false>
+class basic_opt_vector {
 public:
-    opt_vector(): _size(0) {}
+    // The inline limbs are always initialized, so that they are copied as a whole
+    // (a fixed-size copy) instead of size() of them
+    basic_opt_vector(): _size(0), val() {}
 
-    opt_vector(opt_vector const& other): _size(other._size)
+    basic_opt_vector(basic_opt_vector const& other): _size(other._size)
     {
         if (other.is_small())
         {
-            std::copy_n(other.val, other.size(), val);
+            std::copy_n(other.val, SMALL_SZ, val);
         } else
         {
-            other.data[0]++;
+            add_ref(other.data);
             data = other.data;
         }
     }
 
-    opt_vector& operator=(opt_vector const& other)
+    // Takes the buffer (or the inline limbs) of other, which is left empty
+    basic_opt_vector(basic_opt_vector&& other) noexcept: _size(other._size)
+    {
+        if (other.is_small())
+        {
+            std::copy_n(other.val, SMALL_SZ, val);
+        } else
+        {
+            data = other.data;
+            std::fill_n(other.val, SMALL_SZ, 0);
+        }
+        other._size = 0;
+    }
+
+    basic_opt_vector& operator=(basic_opt_vector const& other)
     {
         if (&other != this)
         {
-            opt_vector safe(other);
+            basic_opt_vector safe(other);
             swap(safe);
         }
         return *this;
     }
 
-    ~opt_vector()
+    basic_opt_vector& operator=(basic_opt_vector&& other) noexcept
+    {
+        if (&other != this)
+        {
+            basic_opt_vector safe(std::move(other));
+            swap(safe);
+        }
+        return *this;
+    }
+
+    ~basic_opt_vector()
     {
         if (!is_small())
         {
-            data[0]--;
-            if (data[0] == 0)
-            {
-                operator delete(data);
-            }
+            drop_ref(data);
         }
     }
 
@@ -51,7 +79,7 @@ public:
         return size() == 0;
     }
 
-    void push_back(uint32_t x)
+    void push_back(uint64_t x)
     {
         become_unique();
         if (size() == SMALL_SZ)
@@ -84,7 +112,7 @@ public:
         become_unique();
         if (n > SMALL_SZ)
         {
-            become_big();
+            become_big(n);
         }
         if (is_small())
         {
@@ -109,60 +137,75 @@ public:
         }
     }
 
-    const uint32_t* begin() const
+    // Room for n limbs without changing the size, a later resize up to n does not reallocate
+    void reserve(size_t n)
+    {
+        become_unique();
+        if (n > SMALL_SZ)
+        {
+            become_big(n);
+            if (n > capacity())
+            {
+                expand(n);
+            }
+        }
+    }
+
+    const uint64_t* begin() const
     {
         return is_small() ? val : (data + 2);
     }
 
-    uint32_t* begin()
+    uint64_t* begin()
     {
         become_unique();
         return is_small() ? val : (data + 2);
     }
 
-    const uint32_t* end() const
+    const uint64_t* end() const
     {
         return (is_small() ? val : (data + 2)) + size();
     }
 
-    uint32_t* end()
+    uint64_t* end()
     {
         become_unique();
         return (is_small() ? val : (data + 2)) + size();
     }
 
-    uint32_t const& operator[](size_t i) const
+    uint64_t const& operator[](size_t i) const
     {
         return is_small() ? val[i] : data[i + 2];
     }
 
-    uint32_t& operator[](size_t i)
+    uint64_t& operator[](size_t i)
     {
         become_unique();
         return is_small() ? val[i] : data[i + 2];
     }
 
-    uint32_t const& back() const
+    uint64_t const& back() const
     {
         return is_small() ? val[size() - 1] : data[size() + 1];
     }
 
-    uint32_t& back()
+    uint64_t& back()
     {
         become_unique();
         return is_small() ? val[size() - 1] : data[size() + 1];
     }
 private:
-    static constexpr size_t SMALL_SZ = 2;
+    static_assert(N >= 1, "the inline limbs share their storage with the buffer pointer");
+    static constexpr size_t SMALL_SZ = N;
     static constexpr uint32_t BIG_FLAG = (static_cast<uint32_t>(1) << 31);
     // last bit of _size is an "is big?" flag
     size_t _size;
     union
     {
-        uint32_t val[SMALL_SZ];
+        uint64_t val[SMALL_SZ];
         // data[0] is a reference counter in COW
         // data[1] is capacity
-        uint32_t* data;
+        uint64_t* data;
     };
 
     size_t capacity() const
@@ -170,34 +213,26 @@ private:
         return is_small() ? SMALL_SZ : data[1];
     }
 
-    void swap(opt_vector& other)
+    void swap(basic_opt_vector& other)
     {
-        if (is_small())
+        if (!is_small() && other.is_small())
         {
-            size_t buf_sz = size();
-            uint32_t buf[SMALL_SZ];
-            std::copy_n(val, buf_sz, buf);
-            if (other.is_small())
-            {
-                std::copy_n(other.val, other.size(), val);
-            }
-            else
-            {
-                data = other.data;
-            }
-            std::copy_n(buf, buf_sz, other.val);
+            other.swap(*this);
+            return;
+        }
+        if (!is_small())
+        {
+            std::swap(data, other.data);
+        }
+        else if (!other.is_small())
+        {
+            uint64_t* other_data = other.data;
+            std::copy_n(val, SMALL_SZ, other.val);
+            data = other_data;
         }
         else
         {
-            if (other.is_small()) {
-                uint32_t* buf_data = data;
-                std::copy_n(other.val, other.size(), val);
-                other.data = buf_data;
-            }
-            else
-            {
-                std::swap(data, other.data);
-            }
+            std::swap_ranges(val, val + SMALL_SZ, other.val);
         }
         std::swap(_size, other._size);
     }
@@ -207,39 +242,148 @@ private:
         return (_size & BIG_FLAG) == 0;
     }
 
-    static uint32_t* get_big_data(uint32_t* old_data, size_t old_size, size_t capacity)
+    // Buffers of up to CACHE_LIMBS limbs are not freed right away but kept for reuse,
+    // at most CACHE_SLOTS of them per thread
+    static constexpr size_t CACHE_LIMBS = 1024;
+    static constexpr size_t CACHE_SLOTS = 8;
+
+    struct buffer_cache
+    {
+        uint64_t* buffers[CACHE_SLOTS];
+        size_t count = 0;
+
+        ~buffer_cache()
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                operator delete(buffers[i]);
+            }
+            closed() = true;
+        }
+
+        // Set once the cache of the thread is destroyed, buffers released later
+        // (by static objects) go straight to operator delete
+        static bool& closed()
+        {
+            static thread_local bool value = false;
+            return value;
+        }
+
+        static buffer_cache* get()
+        {
+            static thread_local buffer_cache cache;
+            return closed() ? nullptr : &cache;
+        }
+    };
+
+    // Every buffer is taken from here, a cached one is reused if it is large enough
+    // but not more than twice as large as asked for. data[1] is set to the real capacity.
+    static uint64_t* allocate(size_t capacity)
+    {
+        buffer_cache* cache = (capacity <= CACHE_LIMBS ? buffer_cache::get() : nullptr);
+        if (cache != nullptr)
+        {
+            for (size_t i = cache->count; i-- > 0;)
+            {
+                uint64_t* buffer = cache->buffers[i];
+                if (buffer[1] >= capacity && buffer[1] <= 2 * capacity)
+                {
+                    cache->buffers[i] = cache->buffers[--cache->count];
+                    return buffer;
+                }
+            }
+        }
+        auto* res = static_cast<uint64_t*>(operator new((capacity + 2) * sizeof(uint64_t)));
+        res[1] = capacity;
+        return res;
+    }
+
+    // Every buffer is given back here once its reference count drops to zero.
+    // A full cache drops its oldest buffer, so it follows the sizes currently in use.
+    static void release(uint64_t* buffer)
     {
-        auto* new_data = static_cast<uint32_t*>(operator new((capacity + 2) * sizeof(uint32_t)));
+        buffer_cache* cache = (buffer[1] <= CACHE_LIMBS ? buffer_cache::get() : nullptr);
+        if (cache == nullptr)
+        {
+            operator delete(buffer);
+            return;
+        }
+        if (cache->count == CACHE_SLOTS)
+        {
+            operator delete(cache->buffers[0]);
+            std::copy_n(cache->buffers + 1, --cache->count, cache->buffers);
+        }
+        cache->buffers[cache->count++] = buffer;
+    }
+
+    static uint64_t* get_big_data(uint64_t* old_data, size_t old_size, size_t capacity)
+    {
+        uint64_t* new_data = allocate(capacity);
         new_data[0] = 1;
-        new_data[1] = capacity;
         std::copy_n(old_data, old_size, new_data + 2);
         return new_data;
     }
 
     void expand(size_t new_capacity)
     {
-        uint32_t* new_data = get_big_data(begin(), size(), new_capacity);
-        operator delete(data);
+        uint64_t* new_data = get_big_data(data + 2, size(), new_capacity);
+        release(data);
         data = new_data;
     }
 
-    void become_big()
+    void become_big(size_t new_capacity = 0)
     {
         if (is_small())
         {
             _size |= BIG_FLAG;
-            uint32_t buf[SMALL_SZ];
+            uint64_t buf[SMALL_SZ];
             std::copy_n(val, size(), buf);
-            data = get_big_data(buf, size(), size());
+            data = get_big_data(buf, size(), std::max(size(), new_capacity));
+        }
+    }
+
+    // A new reference needs no ordering, it is made through an existing one
+    static void add_ref(uint64_t* buffer)
+    {
+        if (AtomicRefcount)
+        {
+            __atomic_fetch_add(buffer, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            buffer[0]++;
         }
     }
 
+    // Frees the buffer with the last reference. The decrement releases the reads made through
+    // this reference and the last one acquires all of them before the buffer is reused.
+    static void drop_ref(uint64_t* buffer)
+    {
+        bool last = (AtomicRefcount ? __atomic_sub_fetch(buffer, 1, __ATOMIC_ACQ_REL) == 0 : --buffer[0] == 0);
+        if (last)
+        {
+            release(buffer);
+        }
+    }
+
+    // Seeing a count of one acquires the releases of the owners that are gone, after that
+    // the buffer can be written in place
+    bool is_shared() const
+    {
+        return (AtomicRefcount ? __atomic_load_n(data, __ATOMIC_ACQUIRE) : data[0]) > 1;
+    }
+
+    // The copy is made before the reference is dropped: once dropped, the other owner may
+    // find itself unique and write to the buffer
     void become_unique()
     {
-        if (!is_small() && data[0] > 1)
+        if (!is_small() && is_shared())
         {
-            data[0]--;
-            data = get_big_data(data + 2, size(), capacity());
+            uint64_t* copy = get_big_data(data + 2, size(), capacity());
+            drop_ref(data);
+            data = copy;
         }
     }
 };
+
+typedef basic_opt_vector<1> opt_vector;